@@ -0,0 +1,108 @@
+// Sample path benchmark: pushes synthetic USB blocks through SamplePath and drains the
+// output stream like SDR++ would, for every sample rate and block length the module offers.
+#include <sample_path.h>
+#include <rates.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#define BENCH_BLOCK_VARIANTS 4
+
+struct BenchResult {
+    double nsPerSample;
+    double msps;
+    double p50Us;
+    double p99Us;
+    double maxUs;
+    uint64_t overruns;
+};
+
+BenchResult runCase(int sampleRate, int lengthUs, double seconds) {
+    int blockLen = (int)(((int64_t)sampleRate * lengthUs / 1000000) * 2);
+    int blocks = std::max<int>(100, (int)((seconds * 1000000.0) / lengthUs));
+
+    // A few different random blocks so the kernels can't run on cached constant data
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<int> dist(-32768, 32767);
+    std::vector<std::vector<int16_t>> bufs(BENCH_BLOCK_VARIANTS, std::vector<int16_t>(blockLen));
+    for (auto& b : bufs) {
+        for (auto& v : b) { v = dist(rng); }
+    }
+
+    dsp::stream<dsp::complex_t> out;
+    SamplePath path(&out);
+    path.start(16, blockLen, sampleRate);
+
+    int64_t expected = (int64_t)blocks * (blockLen / 2);
+    int64_t received = 0;
+    std::thread reader([&]() {
+        while (received < expected) {
+            int count = out.read();
+            if (count < 0) { return; }
+            received += count;
+            out.flush();
+        }
+    });
+
+    std::vector<double> durations;
+    durations.reserve(blocks);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < blocks; i++) {
+        // Back off instead of overrunning, throughput is what's measured here
+        while (path.ring.fill() >= path.ring.depth()) { std::this_thread::yield(); }
+        auto t0 = std::chrono::steady_clock::now();
+        path.push(bufs[i % BENCH_BLOCK_VARIANTS].data(), blockLen);
+        auto t1 = std::chrono::steady_clock::now();
+        durations.push_back(std::chrono::duration<double, std::micro>(t1 - t0).count());
+    }
+    reader.join();
+    auto end = std::chrono::steady_clock::now();
+    path.stop();
+
+    std::sort(durations.begin(), durations.end());
+    double elapsed = std::chrono::duration<double>(end - start).count();
+
+    BenchResult res;
+    res.nsPerSample = (elapsed * 1e9) / (double)expected;
+    res.msps = ((double)expected / elapsed) / 1e6;
+    res.p50Us = durations[durations.size() / 2];
+    res.p99Us = durations[(durations.size() * 99) / 100];
+    res.maxUs = durations.back();
+    res.overruns = path.ring.overruns.load();
+    return res;
+}
+
+int main(int argc, char* argv[]) {
+    double seconds = (argc > 1) ? atof(argv[1]) : 1.0;
+    if (seconds <= 0) {
+        fprintf(stderr, "Usage: %s [seconds of signal per case]\n", argv[0]);
+        return 1;
+    }
+
+    int bestRate = 0;
+    printf("%10s %8s %10s %10s %10s %10s %10s\n", "rate", "block", "ns/sample", "MS/s", "p50 us", "p99 us", "max us");
+    for (int r = 0; r < (int)(sizeof(sampleRates) / sizeof(sampleRates[0])); r++) {
+        int rate = sampleRates[r];
+        bool sustained = true;
+        for (int l = 1; l < (int)(sizeof(bufferLengths) / sizeof(bufferLengths[0])); l++) {
+            BenchResult res = runCase(rate, bufferLengths[l], seconds);
+            printf("%10d %6.1fms %10.3f %10.2f %10.2f %10.2f %10.2f\n", rate, bufferLengths[l] / 1000.0,
+                   res.nsPerSample, res.msps, res.p50Us, res.p99Us, res.maxUs);
+
+            // Sustainable means the path keeps up and the callback never eats a whole block period
+            if (res.msps * 1e6 < rate || res.p99Us > bufferLengths[l]) { sustained = false; }
+        }
+        if (sustained && rate > bestRate) { bestRate = rate; }
+    }
+
+    if (bestRate) {
+        printf("Highest sustainable sample rate: %d S/s\n", bestRate);
+    }
+    else {
+        printf("No sample rate can be sustained on this CPU\n");
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+// Peak level above which the gain is always reduced, in dBFS
+#define AGC_PEAK_CEILING_DB -1.0f
+// Largest single gain step in dB
+#define AGC_MAX_STEP 6
+
+// Software AGC keeping the average ADC level near a target. Fed with the block levels measured
+// by the conversion kernel, it averages them over at least one interval, does nothing while the
+// level is inside the hysteresis band and otherwise asks for a new gain through apply.
+// onLevel() runs on the publisher thread, the other calls may come from any thread: the target
+// is atomic and a restart is only picked up by the next onLevel().
+class Agc {
+public:
+    // Takes over the gain identified by control, within [minGain, maxGain], starting from gain,
+    // normally the value currently set on the device
+    void start(int control, int minGain, int maxGain, int gain, int intervalMs) {
+        {
+            std::lock_guard<std::mutex> lck(pendingMtx);
+            pending.control = control;
+            pending.minGain = minGain;
+            pending.maxGain = maxGain;
+            pending.gain = std::clamp<int>(gain, minGain, maxGain);
+            pending.intervalNs = (int64_t)std::max<int>(intervalMs, 10) * 1000000ll;
+            this->gain = pending.gain;
+        }
+        restart.store(true, std::memory_order_release);
+    }
+
+    void setTarget(float targetDb, float hysteresisDb) {
+        this->targetDb = targetDb;
+        this->hysteresisDb = hysteresisDb;
+    }
+
+    // Called by the publisher for every block. power is the sum of |x|^2 over count samples.
+    void onLevel(float blockPower, float blockPeak, int count, int64_t now) {
+        if (restart.exchange(false, std::memory_order_acq_rel)) {
+            std::lock_guard<std::mutex> lck(pendingMtx);
+            active = pending;
+            windowStart = 0;
+            power = 0.0;
+            samples = 0;
+            peak = 0.0f;
+        }
+        if (!windowStart) { windowStart = now; }
+        power += blockPower;
+        samples += count;
+        peak = std::max<float>(peak, blockPeak);
+        if (now - windowStart < active.intervalNs || !samples) { return; }
+
+        float levelDb = 10.0f * log10f((float)(power / samples) + 1e-12f);
+        float peakDb = 20.0f * log10f(peak + 1e-12f);
+        this->levelDb = levelDb;
+        windowStart = now;
+        power = 0.0;
+        samples = 0;
+        peak = 0.0f;
+
+        int delta = 0;
+        float err = targetDb.load(std::memory_order_relaxed) - levelDb;
+        if (peakDb > AGC_PEAK_CEILING_DB) {
+            // Clipping overrides the hysteresis, back off by at least a few dB
+            delta = std::min<int>(-3, (int)floorf(err));
+        }
+        else if (fabsf(err) > hysteresisDb.load(std::memory_order_relaxed)) {
+            delta = (int)roundf(err);
+            // Never raise the gain into clipping
+            if (delta > 0) { delta = std::min<int>(delta, (int)floorf(AGC_PEAK_CEILING_DB - peakDb)); }
+        }
+        delta = std::clamp<int>(delta, -AGC_MAX_STEP, AGC_MAX_STEP);
+
+        int next = std::clamp<int>(active.gain + delta, active.minGain, active.maxGain);
+        if (next == active.gain) { return; }
+        active.gain = next;
+        gain = next;
+        changes.fetch_add(1, std::memory_order_relaxed);
+        if (apply) { apply(active.control, next); }
+    }
+
+    // Set once before the first onLevel(). Runs on the publisher thread, must not block.
+    std::function<void(int control, int gain)> apply;
+
+    std::atomic<int> gain{ 0 };
+    std::atomic<float> levelDb{ -100.0f };
+    std::atomic<uint64_t> changes{ 0 };
+
+private:
+    struct Config {
+        int control = 0;
+        int minGain = 0;
+        int maxGain = 102;
+        int gain = 0;
+        int64_t intervalNs = 250000000;
+    };
+
+    std::atomic<float> targetDb{ -30.0f };
+    std::atomic<float> hysteresisDb{ 6.0f };
+    std::mutex pendingMtx;
+    Config pending;
+    std::atomic<bool> restart{ false };
+
+    // Publisher thread only
+    Config active;
+    int64_t windowStart = 0;
+    double power = 0.0;
+    uint64_t samples = 0;
+    float peak = 0.0f;
+};
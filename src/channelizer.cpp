@@ -0,0 +1,157 @@
+#include "channelizer.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+Channelizer::Channelizer() {}
+
+Channelizer::~Channelizer() {
+    free();
+}
+
+void Channelizer::free() {
+    if (plan) { fftwf_destroy_plan(plan); }
+    if (fftIn) { fftwf_free(fftIn); }
+    if (fftOut) { fftwf_free(fftOut); }
+    plan = NULL;
+    fftIn = NULL;
+    fftOut = NULL;
+}
+
+void Channelizer::init(int channels, double sampleRate) {
+    std::lock_guard<std::mutex> lck(mtx);
+    free();
+    _channels = channels;
+    _sampleRate = sampleRate;
+    int m = channels;
+    taps = m * CHANNELIZER_TAPS_PER_BRANCH;
+
+    // Blackman-Harris windowed sinc, -6 dB at the channel edges so neighbouring channels sum flat
+    std::vector<double> h(taps);
+    double sum = 0.0;
+    for (int i = 0; i < taps; i++) {
+        double t = i - ((taps - 1) / 2.0);
+        double x = M_PI * t / m;
+        double sinc = (t == 0.0) ? 1.0 : (sin(x) / x);
+        double a = 2.0 * M_PI * i / (taps - 1);
+        double w = 0.35875 - 0.48829 * cos(a) + 0.14128 * cos(2.0 * a) - 0.01168 * cos(3.0 * a);
+        h[i] = sinc * w;
+        sum += h[i];
+    }
+
+    // Branch p holds h[p*m .. p*m + m - 1] reversed, so that it lines up with the history
+    // read forwards. Each tap is stored twice to scale I and Q in one float loop.
+    branches.resize(2 * taps);
+    for (int p = 0; p < CHANNELIZER_TAPS_PER_BRANCH; p++) {
+        for (int j = 0; j < m; j++) {
+            float v = (float)(h[(p * m) + (m - 1 - j)] / sum);
+            branches[2 * ((p * m) + j)] = v;
+            branches[2 * ((p * m) + j) + 1] = v;
+        }
+    }
+
+    hist.assign(taps - 1 + CHANNELIZER_CHUNK, { 0.0f, 0.0f });
+    histLen = taps - 1;
+    nextOutput = taps - 1;
+    oddOutput = false;
+    acc.resize(2 * m);
+
+    fftIn = (fftwf_complex*)fftwf_malloc(m * sizeof(fftwf_complex));
+    fftOut = (fftwf_complex*)fftwf_malloc(m * sizeof(fftwf_complex));
+    plan = fftwf_plan_dft_1d(m, fftIn, fftOut, FFTW_BACKWARD, FFTW_ESTIMATE);
+
+    for (auto& o : outputs) { place(o); }
+}
+
+void Channelizer::place(Output& o) {
+    int k = (int)lround(o.offset / spacing());
+    o.channel = ((k % _channels) + _channels) % _channels;
+}
+
+int Channelizer::addOutput(double offset, dsp::stream<dsp::complex_t>* out) {
+    std::lock_guard<std::mutex> lck(mtx);
+    Output o;
+    o.id = nextId++;
+    o.stream = out;
+    o.offset = offset;
+    o.count = 0;
+    if (_channels) { place(o); }
+    outputs.push_back(o);
+    return o.id;
+}
+
+void Channelizer::setOffset(int id, double offset) {
+    std::lock_guard<std::mutex> lck(mtx);
+    for (auto& o : outputs) {
+        if (o.id != id) { continue; }
+        o.offset = offset;
+        if (_channels) { place(o); }
+    }
+}
+
+void Channelizer::removeOutput(int id) {
+    std::lock_guard<std::mutex> lck(mtx);
+    outputs.erase(std::remove_if(outputs.begin(), outputs.end(), [id](const Output& o) { return o.id == id; }), outputs.end());
+    // A swap of this output that started before the removal must be over before its stream goes
+    std::lock_guard<std::mutex> slck(swapMtx);
+}
+
+void Channelizer::process(const dsp::complex_t* in, int count) {
+    std::unique_lock<std::mutex> lck(mtx);
+    if (outputs.empty() || !_channels) { return; }
+    int m = _channels;
+    int decim = m / 2;
+
+    while (count > 0) {
+        int n = std::min<int>(count, CHANNELIZER_CHUNK);
+        memcpy(&hist[histLen], in, n * sizeof(dsp::complex_t));
+        histLen += n;
+        in += n;
+        count -= n;
+
+        for (; nextOutput < histLen; nextOutput += decim) {
+            // Weighted sum of the polyphase branches over the taps ending at nextOutput
+            const float* x = (const float*)&hist[nextOutput - taps + 1];
+            float* __restrict a = acc.data();
+            for (int i = 0; i < 2 * m; i++) { a[i] = 0.0f; }
+            for (int p = CHANNELIZER_TAPS_PER_BRANCH - 1; p >= 0; p--) {
+                const float* __restrict g = &branches[2 * p * m];
+                const float* __restrict xp = &x[2 * (CHANNELIZER_TAPS_PER_BRANCH - 1 - p) * m];
+                for (int i = 0; i < 2 * m; i++) { a[i] += g[i] * xp[i]; }
+            }
+            for (int j = 0; j < m; j++) {
+                fftIn[m - 1 - j][0] = a[2 * j];
+                fftIn[m - 1 - j][1] = a[(2 * j) + 1];
+            }
+            fftwf_execute(plan);
+
+            // Decimating by half the FFT size leaves odd channels negated on every other output
+            for (auto& o : outputs) {
+                float sign = (oddOutput && (o.channel & 1)) ? -1.0f : 1.0f;
+                o.stream->writeBuf[o.count].re = sign * fftOut[o.channel][0];
+                o.stream->writeBuf[o.count].im = sign * fftOut[o.channel][1];
+                o.count++;
+            }
+            oddOutput = !oddOutput;
+        }
+
+        // Keep the history the next output reaches back into
+        int drop = histLen - (taps - 1);
+        memmove(hist.data(), &hist[drop], (taps - 1) * sizeof(dsp::complex_t));
+        histLen = taps - 1;
+        nextOutput -= drop;
+    }
+
+    // Swapping blocks on the readers, the outputs can be retuned meanwhile
+    swaps.clear();
+    for (auto& o : outputs) {
+        if (o.count) { swaps.push_back({ o.stream, o.count }); }
+        o.count = 0;
+    }
+    std::lock_guard<std::mutex> slck(swapMtx);
+    lck.unlock();
+    for (auto& [stream, n] : swaps) {
+        // A stopped stream only means nobody reads this output right now
+        stream->swap(n);
+    }
+}
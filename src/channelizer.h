@@ -0,0 +1,76 @@
+#pragma once
+#include <dsp/stream.h>
+#include <fftw3.h>
+#include <math.h>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Prototype filter taps per polyphase branch
+#define CHANNELIZER_TAPS_PER_BRANCH 12
+// Input samples handled per pass, bounds the history buffer
+#define CHANNELIZER_CHUNK 8192
+
+// Uniform polyphase analysis filterbank, oversampled by 2. Splits the input into channels
+// spaced sampleRate / channels apart and delivers each at 2 * sampleRate / channels, so a
+// channel's edges don't alias. One branch filter pass and one FFT per output sample serve every
+// channel at once. A channel filter only passes its own bin, so outputs sit on the channel grid:
+// an offset is snapped to the nearest multiple of the spacing.
+class Channelizer {
+public:
+    Channelizer();
+    ~Channelizer();
+
+    // channels is a power of two. Outputs are kept and moved to the new channel grid.
+    void init(int channels, double sampleRate);
+
+    int channels() { return _channels; }
+    double spacing() { return _sampleRate / _channels; }
+    double outputRate() { return 2.0 * _sampleRate / _channels; }
+
+    // Nearest offset an output can be centered on with the given spacing
+    static double snap(double offset, double spacing) { return lround(offset / spacing) * spacing; }
+
+    // Publishes the channel nearest to offset Hz from the input center into out, returns an id
+    int addOutput(double offset, dsp::stream<dsp::complex_t>* out);
+    void setOffset(int id, double offset);
+    // The caller must stopWriter() the output's stream first if a reader may have stopped.
+    // The stream isn't touched any more once this returns.
+    void removeOutput(int id);
+
+    // Called from the publisher with every converted block
+    void process(const dsp::complex_t* in, int count);
+
+private:
+    struct Output {
+        int id;
+        dsp::stream<dsp::complex_t>* stream;
+        double offset;
+        int channel;
+        int count;
+    };
+
+    void place(Output& o);
+    void free();
+
+    std::mutex mtx;
+    // Held by process() while it swaps the outputs, taken after mtx
+    std::mutex swapMtx;
+    std::vector<std::pair<dsp::stream<dsp::complex_t>*, int>> swaps;
+    int _channels = 0;
+    double _sampleRate = 0;
+    int taps = 0;
+    // Branch filters reversed and with every tap doubled, multiplied straight into I/Q floats
+    std::vector<float> branches;
+    std::vector<dsp::complex_t> hist;
+    int histLen = 0;
+    int nextOutput = 0;
+    bool oddOutput = false;
+    std::vector<float> acc;
+    fftwf_complex* fftIn = NULL;
+    fftwf_complex* fftOut = NULL;
+    fftwf_plan plan = NULL;
+
+    std::vector<Output> outputs;
+    int nextId = 0;
+};
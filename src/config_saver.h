@@ -0,0 +1,97 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Quiet time after the last change before it is written
+#define CONFIG_SAVE_QUIET_MS 500
+// Longest a change waits while changes keep coming
+#define CONFIG_SAVE_MAX_DELAY_MS 2000
+
+// Collects settings changes on the UI thread and commits them from its own thread once they
+// settle. Scheduling only copies the value, repeated changes to the same key (a slider being
+// dragged) replace each other and end up in a single commit.
+template <class T>
+class ConfigSaver {
+public:
+    typedef std::function<void(const std::map<std::string, T>&)> CommitHandler;
+
+    ConfigSaver(CommitHandler commit) : commit(commit) {
+        workerThread = std::thread(&ConfigSaver::worker, this);
+    }
+
+    ~ConfigSaver() {
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            stopRequested = true;
+        }
+        cnd.notify_all();
+        workerThread.join();
+    }
+
+    void schedule(const std::string& key, const T& value) {
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            auto now = std::chrono::steady_clock::now();
+            if (pending.empty()) { first = now; }
+            last = now;
+            pending[key] = value;
+        }
+        cnd.notify_all();
+    }
+
+    // Commits whatever is pending right away, from the calling thread
+    void flush() {
+        std::unique_lock<std::mutex> lck(mtx);
+        write(lck);
+    }
+
+private:
+    void write(std::unique_lock<std::mutex>& lck) {
+        if (pending.empty()) { return; }
+        // Batches are taken and committed in the same order, a concurrent flush() can't
+        // overwrite newer values with older ones
+        lck.unlock();
+        {
+            std::lock_guard<std::mutex> clck(commitMtx);
+            std::map<std::string, T> batch;
+            lck.lock();
+            batch.swap(pending);
+            lck.unlock();
+            if (!batch.empty()) { commit(batch); }
+        }
+        lck.lock();
+    }
+
+    void worker() {
+        std::unique_lock<std::mutex> lck(mtx);
+        while (!stopRequested) {
+            if (pending.empty()) {
+                cnd.wait(lck);
+                continue;
+            }
+            auto due = std::min(last + std::chrono::milliseconds(CONFIG_SAVE_QUIET_MS),
+                                first + std::chrono::milliseconds(CONFIG_SAVE_MAX_DELAY_MS));
+            if (std::chrono::steady_clock::now() < due) {
+                cnd.wait_until(lck, due);
+                continue;
+            }
+            write(lck);
+        }
+        write(lck);
+    }
+
+    CommitHandler commit;
+    std::mutex mtx;
+    std::mutex commitMtx;
+    std::condition_variable cnd;
+    std::map<std::string, T> pending;
+    std::chrono::steady_clock::time_point first;
+    std::chrono::steady_clock::time_point last;
+    bool stopRequested = false;
+    std::thread workerThread;
+};
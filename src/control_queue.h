@@ -0,0 +1,79 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Runs device control commands on a dedicated thread. Posting a command whose key is still
+// pending replaces it in place, so bursts (slider drags, fast tuning) collapse to the last value.
+class ControlQueue {
+public:
+    ~ControlQueue() {
+        stop();
+    }
+
+    void start() {
+        std::lock_guard<std::mutex> lck(mtx);
+        if (running) { return; }
+        stopRequested = false;
+        running = true;
+        workerThread = std::thread(&ControlQueue::worker, this);
+    }
+
+    // Applies whatever is still pending, then stops the thread
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            if (!running) { return; }
+            stopRequested = true;
+        }
+        cnd.notify_all();
+        workerThread.join();
+        running = false;
+    }
+
+    void post(int key, std::function<void()> fn) {
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            for (auto& cmd : queue) {
+                if (cmd.key == key) {
+                    cmd.fn = std::move(fn);
+                    coalesced.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+            }
+            queue.push_back({ key, std::move(fn) });
+        }
+        cnd.notify_all();
+    }
+
+    std::atomic<uint64_t> coalesced{ 0 };
+
+private:
+    struct Command {
+        int key;
+        std::function<void()> fn;
+    };
+
+    void worker() {
+        std::unique_lock<std::mutex> lck(mtx);
+        while (true) {
+            cnd.wait(lck, [this]() { return !queue.empty() || stopRequested; });
+            if (queue.empty()) { break; }
+            Command cmd = std::move(queue.front());
+            queue.pop_front();
+            lck.unlock();
+            cmd.fn();
+            lck.lock();
+        }
+    }
+
+    std::deque<Command> queue;
+    std::mutex mtx;
+    std::condition_variable cnd;
+    std::thread workerThread;
+    bool running = false;
+    bool stopRequested = false;
+};
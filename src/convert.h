@@ -0,0 +1,219 @@
+#pragma once
+#include <dsp/types.h>
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Signal level gathered during conversion, relative to full scale. Kernels accumulate into it
+// so a block converted in several chunks yields the level of the whole block.
+struct BlockLevel {
+    // Sum of |x|^2
+    float power = 0.0f;
+    // Largest |I| or |Q|
+    float peak = 0.0f;
+    // I and Q values within two ADC codes of full scale
+    int clipped = 0;
+};
+
+// Converts count interleaved int16 IQ pairs to complex floats
+typedef void (*ConvertKernel)(const int16_t* in, dsp::complex_t* out, int count, BlockLevel* level);
+
+// libmirisdr left-justifies every S16 format in the 16 bit container, so full scale is
+// always 2^15. BITS is the real ADC resolution, one LSB is 2^(16 - BITS) container counts.
+template <int BITS>
+constexpr int convertLsb() {
+    static_assert(BITS >= 8 && BITS <= 16, "Unsupported sample resolution");
+    return 1 << (16 - BITS);
+}
+
+// A value is counted as clipped when it is one of the two outermost codes of the real ADC
+// resolution, relative to full scale
+template <int BITS>
+constexpr float convertClipLevel() {
+    return (float)(32768 - (2 * convertLsb<BITS>())) / 32768.0f;
+}
+
+// One pass int16 -> float conversion with scaling and optional I/Q swap and Q negation.
+// The swap is applied first, Q negation (spectrum inversion) is folded into the scale vector.
+// Power, peak and clip count are taken from the converted registers, so they cost no extra
+// memory traffic. The scale is the same for every format since all are left-justified, BITS
+// only sets the clip level, the outermost codes of that resolution.
+template <int BITS, bool SWAP_IQ, bool INVERT_Q>
+void convertKernel(const int16_t* in, dsp::complex_t* out, int count, BlockLevel* level) {
+    constexpr float iScale = 1.0f / 32768.0f;
+    constexpr float qScale = INVERT_Q ? -iScale : iScale;
+    float* o = (float*)out;
+    int n = count * 2;
+    int i = 0;
+    float power = 0.0f;
+    float peak = 0.0f;
+    int clipped = 0;
+    constexpr float clipLevel = convertClipLevel<BITS>();
+
+#if defined(__AVX512F__)
+    const __m512 scale = _mm512_setr_ps(iScale, qScale, iScale, qScale, iScale, qScale, iScale, qScale,
+                                        iScale, qScale, iScale, qScale, iScale, qScale, iScale, qScale);
+    __m512 vPower = _mm512_setzero_ps();
+    __m512 vPeak = _mm512_setzero_ps();
+    const __m512 vClip = _mm512_set1_ps(clipLevel);
+    for (; i + 16 <= n; i += 16) {
+        __m512 f = _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*)&in[i])));
+        if (SWAP_IQ) { f = _mm512_permute_ps(f, 0xB1); }
+        __m512 r = _mm512_mul_ps(f, scale);
+        _mm512_storeu_ps(&o[i], r);
+        __m512 a = _mm512_abs_ps(r);
+        vPower = _mm512_fmadd_ps(r, r, vPower);
+        vPeak = _mm512_max_ps(vPeak, a);
+        clipped += __builtin_popcount(_mm512_cmp_ps_mask(a, vClip, _CMP_GE_OQ));
+    }
+    power = _mm512_reduce_add_ps(vPower);
+    peak = _mm512_reduce_max_ps(vPeak);
+#elif defined(__AVX2__)
+    const __m256 scale = _mm256_setr_ps(iScale, qScale, iScale, qScale, iScale, qScale, iScale, qScale);
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    __m256 vPower = _mm256_setzero_ps();
+    __m256 vPeak = _mm256_setzero_ps();
+    const __m256 vClip = _mm256_set1_ps(clipLevel);
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)&in[i]);
+        __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(v)));
+        __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1)));
+        if (SWAP_IQ) {
+            lo = _mm256_permute_ps(lo, 0xB1);
+            hi = _mm256_permute_ps(hi, 0xB1);
+        }
+        lo = _mm256_mul_ps(lo, scale);
+        hi = _mm256_mul_ps(hi, scale);
+        _mm256_storeu_ps(&o[i], lo);
+        _mm256_storeu_ps(&o[i + 8], hi);
+        __m256 aLo = _mm256_andnot_ps(signMask, lo);
+        __m256 aHi = _mm256_andnot_ps(signMask, hi);
+        vPower = _mm256_add_ps(vPower, _mm256_add_ps(_mm256_mul_ps(lo, lo), _mm256_mul_ps(hi, hi)));
+        vPeak = _mm256_max_ps(vPeak, _mm256_max_ps(aLo, aHi));
+        int mask = _mm256_movemask_ps(_mm256_cmp_ps(aLo, vClip, _CMP_GE_OQ)) | (_mm256_movemask_ps(_mm256_cmp_ps(aHi, vClip, _CMP_GE_OQ)) << 8);
+        clipped += __builtin_popcount(mask);
+    }
+    float tPower[8], tPeak[8];
+    _mm256_storeu_ps(tPower, vPower);
+    _mm256_storeu_ps(tPeak, vPeak);
+    for (int k = 0; k < 8; k++) {
+        power += tPower[k];
+        peak = std::max<float>(peak, tPeak[k]);
+    }
+#elif defined(__ARM_NEON)
+    const float scaleArr[4] = { iScale, qScale, iScale, qScale };
+    const float32x4_t scale = vld1q_f32(scaleArr);
+    float32x4_t vPower = vdupq_n_f32(0);
+    float32x4_t vPeak = vdupq_n_f32(0);
+    const float32x4_t vClip = vdupq_n_f32(clipLevel);
+    uint32x4_t vClipped = vdupq_n_u32(0);
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t v = vld1q_s16(&in[i]);
+        float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)));
+        float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v)));
+        if (SWAP_IQ) {
+            lo = vrev64q_f32(lo);
+            hi = vrev64q_f32(hi);
+        }
+        lo = vmulq_f32(lo, scale);
+        hi = vmulq_f32(hi, scale);
+        vst1q_f32(&o[i], lo);
+        vst1q_f32(&o[i + 4], hi);
+        float32x4_t aLo = vabsq_f32(lo);
+        float32x4_t aHi = vabsq_f32(hi);
+        vPower = vmlaq_f32(vmlaq_f32(vPower, lo, lo), hi, hi);
+        vPeak = vmaxq_f32(vPeak, vmaxq_f32(aLo, aHi));
+        // Comparison lanes are all ones when true, subtracting them counts
+        vClipped = vsubq_u32(vsubq_u32(vClipped, vcgeq_f32(aLo, vClip)), vcgeq_f32(aHi, vClip));
+    }
+    float tPower[4], tPeak[4];
+    uint32_t tClipped[4];
+    vst1q_f32(tPower, vPower);
+    vst1q_f32(tPeak, vPeak);
+    vst1q_u32(tClipped, vClipped);
+    for (int k = 0; k < 4; k++) {
+        power += tPower[k];
+        peak = std::max<float>(peak, tPeak[k]);
+        clipped += tClipped[k];
+    }
+#endif
+
+    for (; i < n; i += 2) {
+        float re = (float)in[SWAP_IQ ? i + 1 : i];
+        float im = (float)in[SWAP_IQ ? i : i + 1];
+        o[i] = re * iScale;
+        o[i + 1] = im * qScale;
+        power += (o[i] * o[i]) + (o[i + 1] * o[i + 1]);
+        peak = std::max<float>(peak, std::max<float>(fabsf(o[i]), fabsf(o[i + 1])));
+        clipped += (fabsf(o[i]) >= clipLevel) + (fabsf(o[i + 1]) >= clipLevel);
+    }
+
+    level->power += power;
+    level->peak = std::max<float>(level->peak, peak);
+    level->clipped += clipped;
+}
+
+// Level of a block without converting it, for when no float samples are needed. Swap and
+// inversion don't change the level, so one variant per resolution serves every kernel.
+typedef void (*LevelKernel)(const int16_t* in, int count, BlockLevel* level);
+
+template <int BITS>
+void levelKernel(const int16_t* in, int count, BlockLevel* level) {
+    constexpr int clipCode = (int)(convertClipLevel<BITS>() * 32768.0f);
+    int n = count * 2;
+    int64_t power = 0;
+    int peak = 0;
+    int clipped = 0;
+    // Integer only, so the compiler vectorizes it
+    for (int i = 0; i < n; i++) {
+        int v = in[i];
+        int a = (v < 0) ? -v : v;
+        power += v * v;
+        peak = std::max<int>(peak, a);
+        clipped += (a >= clipCode);
+    }
+    level->power += (float)power * (1.0f / (32768.0f * 32768.0f));
+    level->peak = std::max<float>(level->peak, peak / 32768.0f);
+    level->clipped += clipped;
+}
+
+inline LevelKernel selectLevelKernel(int bits) {
+    switch (bits) {
+    case 8:
+        return levelKernel<8>;
+    case 12:
+        return levelKernel<12>;
+    case 14:
+        return levelKernel<14>;
+    default:
+        return levelKernel<16>;
+    }
+}
+
+template <int BITS>
+ConvertKernel selectConvertKernel(bool swapIQ, bool invertQ) {
+    if (swapIQ) {
+        return invertQ ? convertKernel<BITS, true, true> : convertKernel<BITS, true, false>;
+    }
+    return invertQ ? convertKernel<BITS, false, true> : convertKernel<BITS, false, false>;
+}
+
+// Picks the kernel for a given ADC resolution, meant to be called once per stream start
+inline ConvertKernel selectConvertKernel(int bits, bool swapIQ, bool invertQ) {
+    switch (bits) {
+    case 8:
+        return selectConvertKernel<8>(swapIQ, invertQ);
+    case 12:
+        return selectConvertKernel<12>(swapIQ, invertQ);
+    case 14:
+        return selectConvertKernel<14>(swapIQ, invertQ);
+    default:
+        return selectConvertKernel<16>(swapIQ, invertQ);
+    }
+}
@@ -0,0 +1,206 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+#include "scanner.h"
+
+// Blocks buffered per subscriber when it doesn't ask for a depth
+#define CS16_DEFAULT_QUEUE 4
+// Most blocks a subscriber can have buffered
+#define CS16_MAX_QUEUE 32
+
+// Commands of the "mirisdr_source" module interface, registered under the instance name
+enum {
+    // in: int* queue depth in blocks or NULL, out: Cs16Subscriber**, NULL if the device could
+    // not be started. Starts the device if idle.
+    MIRISDR_IFACE_CMD_SUBSCRIBE_CS16,
+    // in: Cs16Subscriber*, whose reader must have stopped. Stops the device if nobody else uses it.
+    MIRISDR_IFACE_CMD_UNSUBSCRIBE_CS16,
+    // Like MIRISDR_IFACE_CMD_SUBSCRIBE_CS16, but only receives the settled samples of each hop
+    // while scanning, with Cs16Block::hop set. Unsubscribed with MIRISDR_IFACE_CMD_UNSUBSCRIBE_CS16.
+    MIRISDR_IFACE_CMD_SUBSCRIBE_HOPS,
+};
+
+// A device block as received: interleaved int16 I/Q, left-justified to 16 bits, without I/Q
+// swap, spectrum inversion, correction, decimation or scan gating. data points into one of the
+// subscriber's buffers and stays valid until the block is released.
+struct Cs16Block {
+    const int16_t* data;
+    int count; // Complex samples
+    uint64_t sampleIndex;
+    int64_t arrivalNs;
+    int sampleRate;
+    int buffer;
+    HopTag hop; // Only set for hop subscribers, hop.count is 0 otherwise
+};
+
+// One consumer of the int16 blocks with its own pool of block buffers. read() and release()
+// are meant for the consumer's thread. When every buffer is taken the oldest unread block is
+// dropped, a subscriber that doesn't release its blocks only loses blocks itself.
+class Cs16Subscriber {
+public:
+    Cs16Subscriber(int depth) : buffers(depth), blocks(depth), states(depth, BUFFER_FREE) {}
+
+    // Waits for the next block, false once the reader was stopped
+    bool read(Cs16Block& block) {
+        std::unique_lock<std::mutex> lck(mtx);
+        cnd.wait(lck, [this]() { return !queue.empty() || readerStop; });
+        if (readerStop) { return false; }
+        int b = queue.front();
+        queue.pop_front();
+        states[b] = BUFFER_READING;
+        block = blocks[b];
+        return true;
+    }
+
+    void release(const Cs16Block& block) {
+        std::lock_guard<std::mutex> lck(mtx);
+        states[block.buffer] = BUFFER_FREE;
+    }
+
+    void stopReader() {
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            readerStop = true;
+        }
+        cnd.notify_all();
+    }
+
+    void clearReadStop() {
+        std::lock_guard<std::mutex> lck(mtx);
+        readerStop = false;
+    }
+
+    // Blocks lost because every buffer was taken
+    std::atomic<uint64_t> dropped{ 0 };
+
+private:
+    friend class Cs16Stream;
+
+    enum BufferState {
+        BUFFER_FREE,
+        BUFFER_FILLING,
+        BUFFER_QUEUED,
+        BUFFER_READING
+    };
+
+    // Publisher side. The copy is made outside the lock, the buffer is marked as being filled
+    // so the reader can't see it meanwhile.
+    void push(const Cs16Block& src) {
+        int b;
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            auto it = std::find(states.begin(), states.end(), BUFFER_FREE);
+            if (it != states.end()) {
+                b = it - states.begin();
+            }
+            else if (!queue.empty()) {
+                b = queue.front();
+                queue.pop_front();
+                dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+            else {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            states[b] = BUFFER_FILLING;
+        }
+
+        // Free buffers belong to nobody, growing one after a block size change is safe
+        std::vector<int16_t>& buf = buffers[b];
+        if ((int)buf.size() < src.count * 2) { buf.resize(src.count * 2); }
+        memcpy(buf.data(), src.data, src.count * 2 * sizeof(int16_t));
+        blocks[b] = src;
+        blocks[b].data = buf.data();
+        blocks[b].buffer = b;
+
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            states[b] = BUFFER_QUEUED;
+            queue.push_back(b);
+        }
+        cnd.notify_one();
+    }
+
+    std::vector<std::vector<int16_t>> buffers;
+    std::vector<Cs16Block> blocks;
+    std::vector<BufferState> states;
+    std::deque<int> queue;
+    std::mutex mtx;
+    std::condition_variable cnd;
+    bool readerStop = false;
+};
+
+// Hands the device blocks to int16 consumers. Each subscriber gets a copy in its own buffers
+// (4 bytes per sample, half of the float path), so a slow or stuck one never holds on to the
+// sample ring and never stalls the USB transfers, the float path or the other subscribers.
+class Cs16Stream {
+public:
+    // Hop subscribers only get the samples the scanner publishes, each block tagged with its hop
+    Cs16Subscriber* subscribe(int depth, bool hops = false) {
+        std::lock_guard<std::mutex> lck(mtx);
+        std::vector<std::unique_ptr<Cs16Subscriber>>& list = hops ? hopSubs : subs;
+        list.push_back(std::make_unique<Cs16Subscriber>(std::clamp<int>(depth, 1, CS16_MAX_QUEUE)));
+        updateCounts();
+        return list.back().get();
+    }
+
+    void unsubscribe(Cs16Subscriber* sub) {
+        std::lock_guard<std::mutex> lck(mtx);
+        auto match = [sub](const auto& s) { return s.get() == sub; };
+        subs.erase(std::remove_if(subs.begin(), subs.end(), match), subs.end());
+        hopSubs.erase(std::remove_if(hopSubs.begin(), hopSubs.end(), match), hopSubs.end());
+        updateCounts();
+    }
+
+    int subscribers() { return rawCount.load(std::memory_order_relaxed) + hopCount.load(std::memory_order_relaxed); }
+    int rawSubscribers() { return rawCount.load(std::memory_order_relaxed); }
+    int hopSubscribers() { return hopCount.load(std::memory_order_relaxed); }
+
+    // Called by the publisher thread for every device block, count in complex samples
+    void publish(const int16_t* data, int count, uint64_t sampleIndex, int64_t arrivalNs, int sampleRate) {
+        Cs16Block block;
+        block.data = data;
+        block.count = count;
+        block.sampleIndex = sampleIndex;
+        block.arrivalNs = arrivalNs;
+        block.sampleRate = sampleRate;
+        block.buffer = -1;
+        block.hop = HopTag{};
+        std::lock_guard<std::mutex> lck(mtx);
+        for (auto& s : subs) { s->push(block); }
+    }
+
+    // Called by the publisher thread with the part of a block the scanner kept, data starts
+    // at tag.firstSample and holds tag.count complex samples
+    void publishHop(const int16_t* data, const HopTag& tag, int64_t arrivalNs, int sampleRate) {
+        Cs16Block block;
+        block.data = data;
+        block.count = tag.count;
+        block.sampleIndex = tag.firstSample;
+        block.arrivalNs = arrivalNs;
+        block.sampleRate = sampleRate;
+        block.buffer = -1;
+        block.hop = tag;
+        std::lock_guard<std::mutex> lck(mtx);
+        for (auto& s : hopSubs) { s->push(block); }
+    }
+
+private:
+    void updateCounts() {
+        rawCount = subs.size();
+        hopCount = hopSubs.size();
+    }
+
+    std::vector<std::unique_ptr<Cs16Subscriber>> subs;
+    std::vector<std::unique_ptr<Cs16Subscriber>> hopSubs;
+    std::atomic<int> rawCount{ 0 };
+    std::atomic<int> hopCount{ 0 };
+    std::mutex mtx;
+};
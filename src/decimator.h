@@ -0,0 +1,155 @@
+#pragma once
+#include <dsp/types.h>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define HALFBAND_TAPS 31
+
+// Decimate by 2 half-band FIR. Every other tap of a half-band filter is zero, so only the
+// center tap and the odd taps are evaluated, symmetric pairs are summed before multiplying.
+// The vector paths compute several neighbouring outputs at once.
+class HalfBandDecimator {
+public:
+    HalfBandDecimator() {
+        // Blackman windowed sinc with cutoff at a quarter of the input rate
+        for (int i = 0; i < HALFBAND_TAPS / 4 + 1; i++) {
+            int k = (2 * i) + 1;
+            double x = M_PI * k / 2.0;
+            double n = (HALFBAND_TAPS / 2) + k;
+            double w = 0.42 - 0.5 * cos(2.0 * M_PI * n / (HALFBAND_TAPS - 1)) + 0.08 * cos(4.0 * M_PI * n / (HALFBAND_TAPS - 1));
+            taps[i] = (float)(0.5 * (sin(x) / x) * w);
+        }
+    }
+
+    void init(int maxBlock) {
+        buf.resize(HALFBAND_TAPS + maxBlock);
+        reset();
+    }
+
+    void reset() {
+        memset(buf.data(), 0, (HALFBAND_TAPS - 1) * sizeof(dsp::complex_t));
+        bufLen = HALFBAND_TAPS - 1;
+    }
+
+    // out may alias in. Returns the number of output samples, odd leftovers carry over.
+    int process(const dsp::complex_t* in, int count, dsp::complex_t* out) {
+        memcpy(&buf[bufLen], in, count * sizeof(dsp::complex_t));
+        bufLen += count;
+
+        const dsp::complex_t* x = buf.data();
+        int produced = 0;
+        int pos = 0;
+
+#if defined(__AVX2__)
+        // Eight outputs per iteration, a complex sample is one double lane. The inputs of a tap
+        // for consecutive outputs are every other sample, the even or odd half of two loads.
+        // That split comes out as outputs 0, 2, 1, 3, the final permute restores the order.
+        // Two independent accumulators, one alone would wait on the latency of its own adds.
+        for (; pos + 14 + HALFBAND_TAPS <= bufLen; pos += 16) {
+            const double* c = (const double*)&x[pos + (HALFBAND_TAPS / 2)];
+            const __m256 half = _mm256_set1_ps(0.5f);
+            // Centers are the odd samples from c - 1
+            __m256 acc0 = _mm256_mul_ps(half, oddSamples(c - 1));
+            __m256 acc1 = _mm256_mul_ps(half, oddSamples(c + 7));
+            for (int i = 0; i < HALFBAND_TAPS / 4 + 1; i++) {
+                int k = (2 * i) + 1;
+                const __m256 tap = _mm256_set1_ps(taps[i]);
+                acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(tap, _mm256_add_ps(evenSamples(c - k), oddSamples(c + k - 1))));
+                acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(tap, _mm256_add_ps(evenSamples(c - k + 8), oddSamples(c + k + 7))));
+            }
+            _mm256_storeu_pd((double*)&out[produced], _mm256_permute4x64_pd(_mm256_castps_pd(acc0), 0xD8));
+            _mm256_storeu_pd((double*)&out[produced + 4], _mm256_permute4x64_pd(_mm256_castps_pd(acc1), 0xD8));
+            produced += 8;
+        }
+#elif defined(__ARM_NEON)
+        // Two outputs per iteration, each half of a register is one complex sample
+        for (; pos + 2 + HALFBAND_TAPS <= bufLen; pos += 4) {
+            const float* c = (const float*)&x[pos + (HALFBAND_TAPS / 2)];
+            float32x4_t acc = vmulq_n_f32(pairOfSamples(c), 0.5f);
+            for (int i = 0; i < HALFBAND_TAPS / 4 + 1; i++) {
+                int k = (2 * i) + 1;
+                float32x4_t pair = vaddq_f32(pairOfSamples(c - (2 * k)), pairOfSamples(c + (2 * k)));
+                acc = vmlaq_n_f32(acc, pair, taps[i]);
+            }
+            vst1q_f32((float*)&out[produced], acc);
+            produced += 2;
+        }
+#endif
+
+        for (; pos + HALFBAND_TAPS <= bufLen; pos += 2) {
+            const dsp::complex_t* c = &x[pos + (HALFBAND_TAPS / 2)];
+            float re = 0.5f * c->re;
+            float im = 0.5f * c->im;
+            for (int i = 0; i < HALFBAND_TAPS / 4 + 1; i++) {
+                int k = (2 * i) + 1;
+                re += taps[i] * (c[-k].re + c[k].re);
+                im += taps[i] * (c[-k].im + c[k].im);
+            }
+            out[produced].re = re;
+            out[produced].im = im;
+            produced++;
+        }
+
+        bufLen -= pos;
+        memmove(buf.data(), &buf[pos], bufLen * sizeof(dsp::complex_t));
+        return produced;
+    }
+
+private:
+#if defined(__AVX2__)
+    // Samples 0, 4, 2, 6 of the eight starting at p
+    static inline __m256 evenSamples(const double* p) {
+        return _mm256_castpd_ps(_mm256_shuffle_pd(_mm256_loadu_pd(p), _mm256_loadu_pd(p + 4), 0x0));
+    }
+
+    // Samples 1, 5, 3, 7 of the eight starting at p
+    static inline __m256 oddSamples(const double* p) {
+        return _mm256_castpd_ps(_mm256_shuffle_pd(_mm256_loadu_pd(p), _mm256_loadu_pd(p + 4), 0xF));
+    }
+#elif defined(__ARM_NEON)
+    // Samples 0 and 2 starting at p
+    static inline float32x4_t pairOfSamples(const float* p) {
+        return vcombine_f32(vld1_f32(p), vld1_f32(p + 4));
+    }
+#endif
+
+    float taps[HALFBAND_TAPS / 4 + 1];
+    std::vector<dsp::complex_t> buf;
+    int bufLen = 0;
+};
+
+// Cascade of half-band stages for power of two decimation
+class Decimator {
+public:
+    void init(int factor, int maxBlock) {
+        stages.clear();
+        for (int f = factor; f > 1; f >>= 1) {
+            stages.emplace_back();
+            stages.back().init(maxBlock);
+        }
+    }
+
+    void reset() {
+        for (auto& s : stages) { s.reset(); }
+    }
+
+    bool enabled() { return !stages.empty(); }
+
+    // Runs the cascade in place on in, the last stage writes to out
+    int process(dsp::complex_t* in, int count, dsp::complex_t* out) {
+        for (int i = 0; i < (int)stages.size(); i++) {
+            count = stages[i].process(in, count, (i == (int)stages.size() - 1) ? out : in);
+        }
+        return count;
+    }
+
+private:
+    std::vector<HalfBandDecimator> stages;
+};
@@ -0,0 +1,35 @@
+#pragma once
+#include <stdint.h>
+
+typedef void (*DeviceReadCallback)(unsigned char* buf, uint32_t len, void* ctx);
+
+// Device backend interface, mirrors the subset of the libmirisdr API used by the module.
+// All methods return 0 on success like their libmirisdr counterparts.
+class DeviceBackend {
+public:
+    virtual ~DeviceBackend() {}
+
+    virtual int open() = 0;
+    virtual int close() = 0;
+
+    virtual int setHwFlavour(bool sdrplay) = 0;
+    virtual int setSampleFormat(const char* format) = 0;
+    virtual int setTransfer(const char* transfer) = 0;
+    virtual int setSampleRate(uint32_t rate) = 0;
+    virtual int setBandwidth(uint32_t bw) = 0;
+    virtual int setCenterFreq(uint32_t freq) = 0;
+    virtual uint32_t getCenterFreq() = 0;
+    virtual int setOffsetTuning(bool enabled) = 0;
+    virtual int setIfFreq(uint32_t freq) = 0;
+    virtual int setTunerGain(int gain) = 0;
+    virtual int setMixerGain(int gain) = 0;
+    virtual int setMixbufferGain(int gain) = 0;
+    virtual int setLnaGain(int gain) = 0;
+    virtual int setBasebandGain(int gain) = 0;
+    virtual int setBias(bool enabled) = 0;
+    virtual int resetBuffer() = 0;
+
+    // Blocks and calls cb with bufLen byte blocks of interleaved int16 IQ until cancelAsync()
+    virtual int readAsync(DeviceReadCallback cb, void* ctx, uint32_t bufNum, uint32_t bufLen) = 0;
+    virtual int cancelAsync() = 0;
+};
@@ -0,0 +1,171 @@
+#include "device_registry.h"
+#include <utils/flog.h>
+#include <libusb.h>
+#include <mirisdr.h>
+#include <algorithm>
+
+// Same table libmirisdr matches against
+static const MirisdrUsbId mirisdrUsbIds[] = {
+    { 0x1df7, 0x2500 }, // Mirics MSi2500 reference design, SDRplay RSP1
+    { 0x2040, 0xd300 }, // Hauppauge WinTV 133559 LF
+    { 0x07ca, 0x8591 }, // AverMedia A859 Pure DVBT
+    { 0x04bb, 0x0537 }, // IO-DATA GV-TV100
+    { 0x0511, 0x0037 }, // Logitec LDT-1S310U/J
+};
+
+static int hotplugCallback(libusb_context*, libusb_device*, libusb_hotplug_event, void* userData) {
+    // Strings can't be read from inside a libusb callback, the event thread updates afterwards
+    ((DeviceRegistry*)userData)->onHotplug();
+    return 0;
+}
+
+DeviceRegistry& DeviceRegistry::get() {
+    static DeviceRegistry registry;
+    return registry;
+}
+
+void DeviceRegistry::acquire() {
+    std::lock_guard<std::mutex> lck(mtx);
+    if (refs++) { return; }
+
+    if (libusb_init(&ctx)) {
+        flog::error("Could not initialize libusb, Mirisdr devices are listed by libmirisdr only");
+        ctx = NULL;
+    }
+    if (ctx && libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+        int err = libusb_hotplug_register_callback(ctx, (libusb_hotplug_event)(LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
+                                                   LIBUSB_HOTPLUG_NO_FLAGS, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+                                                   LIBUSB_HOTPLUG_MATCH_ANY, hotplugCallback, this, &hotplugHandle);
+        hotplug = !err;
+        if (err) {
+            flog::warn("Could not register for USB hotplug events ({0})", libusb_error_name(err));
+        }
+    }
+    if (!hotplug) {
+        flog::warn("No USB hotplug notifications, press Refresh after plugging in a Mirisdr device");
+    }
+
+    update(true);
+    if (hotplug) {
+        running = true;
+        workerThread = std::thread(&DeviceRegistry::worker, this);
+    }
+}
+
+void DeviceRegistry::release() {
+    std::lock_guard<std::mutex> lck(mtx);
+    if (--refs) { return; }
+    if (hotplug) {
+        running = false;
+        workerThread.join();
+        libusb_hotplug_deregister_callback(ctx, hotplugHandle);
+        hotplug = false;
+    }
+    if (ctx) { libusb_exit(ctx); }
+    ctx = NULL;
+    std::lock_guard<std::mutex> llck(listMtx);
+    order.clear();
+    names.clear();
+}
+
+std::vector<std::string> DeviceRegistry::list() {
+    std::lock_guard<std::mutex> lck(listMtx);
+    std::vector<std::string> ret;
+    for (auto& key : order) {
+        auto it = names.find(key);
+        if (it != names.end()) { ret.push_back(it->second); }
+    }
+    return ret;
+}
+
+int DeviceRegistry::indexOf(const std::string& name) {
+    std::lock_guard<std::mutex> lck(listMtx);
+    for (int i = 0; i < (int)order.size(); i++) {
+        auto it = names.find(order[i]);
+        if (it != names.end() && it->second == name) { return i; }
+    }
+    return -1;
+}
+
+void DeviceRegistry::rescan() {
+    std::lock_guard<std::mutex> lck(mtx);
+    update(true);
+}
+
+std::vector<std::pair<int, int>> DeviceRegistry::enumerate() {
+    std::vector<std::pair<int, int>> found;
+    if (!ctx) { return found; }
+    libusb_device** devs;
+    ssize_t cnt = libusb_get_device_list(ctx, &devs);
+    if (cnt < 0) { return found; }
+    for (ssize_t i = 0; i < cnt; i++) {
+        libusb_device_descriptor desc;
+        if (libusb_get_device_descriptor(devs[i], &desc)) { continue; }
+        for (const auto& id : mirisdrUsbIds) {
+            if (desc.idVendor == id.vid && desc.idProduct == id.pid) {
+                found.push_back({ libusb_get_bus_number(devs[i]), libusb_get_device_address(devs[i]) });
+                break;
+            }
+        }
+    }
+    libusb_free_device_list(devs, 1);
+    return found;
+}
+
+void DeviceRegistry::update(bool full) {
+    std::lock_guard<std::mutex> ulck(updateMtx);
+    std::vector<std::pair<int, int>> now = enumerate();
+
+    // Indices are only derived from our own enumeration while libmirisdr sees the same dongles
+    int count = mirisdr_get_device_count();
+    if ((int)now.size() != count) {
+        if (ctx) {
+            flog::warn("Mirisdr registry sees {0} devices but libmirisdr {1}, querying all of them", now.size(), count);
+        }
+        now.clear();
+        for (int i = 0; i < count; i++) { now.push_back({ -1, i }); }
+        full = true;
+    }
+
+    std::map<std::pair<int, int>, std::string> known;
+    {
+        std::lock_guard<std::mutex> lck(listMtx);
+        if (!full) { known = names; }
+    }
+
+    std::map<std::pair<int, int>, std::string> found;
+    for (int i = 0; i < (int)now.size(); i++) {
+        auto it = known.find(now[i]);
+        if (it != known.end()) {
+            found[now[i]] = it->second;
+            continue;
+        }
+        char manufact[256];
+        char product[256];
+        char serial[256];
+        if (mirisdr_get_device_usb_strings(i, manufact, product, serial)) {
+            flog::warn("Could not read the USB strings of Mirisdr device {0}", i);
+            continue;
+        }
+        found[now[i]] = std::string(manufact) + " " + std::string(product) + " " + std::string(serial);
+        if (!full) { flog::info("Mirisdr device '{0}' attached", found[now[i]]); }
+    }
+    for (auto& [key, name] : known) {
+        if (!found.count(key)) { flog::info("Mirisdr device '{0}' removed", name); }
+    }
+
+    std::lock_guard<std::mutex> lck(listMtx);
+    if (now == order && found == names) { return; }
+    order = now;
+    names = found;
+    _generation++;
+}
+
+void DeviceRegistry::worker() {
+    while (running) {
+        // The timeout bounds how long release() waits for this thread
+        timeval tv = { 0, 100000 };
+        libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+        if (dirty.exchange(false)) { update(false); }
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+struct libusb_context;
+
+// USB IDs libmirisdr accepts, its device indices count only these, in libusb enumeration order
+struct MirisdrUsbId {
+    uint16_t vid;
+    uint16_t pid;
+};
+
+// Cache of attached Mirisdr dongles shared by all module instances. Names are the
+// "<manufacturer> <product> <serial>" strings used as device keys in the config. A dongle is
+// only queried for its strings when it shows up, later lookups resolve a name to its
+// libmirisdr index from the enumeration order alone, without opening anything. libusb hotplug
+// events keep it current; without hotplug support it is refreshed by rescan().
+class DeviceRegistry {
+public:
+    static DeviceRegistry& get();
+
+    // Reference counted by the instances, the first starts hotplug monitoring, the last stops it
+    void acquire();
+    void release();
+
+    // Names in libmirisdr index order
+    std::vector<std::string> list();
+
+    // libmirisdr index of the named device, -1 if it isn't attached
+    int indexOf(const std::string& name);
+
+    // Incremented whenever the list changes
+    uint64_t generation() { return _generation.load(); }
+
+    // Queries every dongle again
+    void rescan();
+
+    // Called from libusb on the registry's event thread
+    void onHotplug() { dirty = true; }
+
+private:
+    DeviceRegistry() {}
+
+    // (bus, address) of the attached dongles in enumeration order
+    std::vector<std::pair<int, int>> enumerate();
+    void update(bool full);
+    void worker();
+
+    std::mutex mtx;
+    int refs = 0;
+    libusb_context* ctx = NULL;
+    bool hotplug = false;
+    int hotplugHandle = 0;
+    std::thread workerThread;
+    std::atomic<bool> running{ false };
+    std::atomic<bool> dirty{ false };
+    std::atomic<uint64_t> _generation{ 0 };
+
+    // Serializes update() between the event thread and rescan()
+    std::mutex updateMtx;
+    std::vector<std::pair<int, int>> order;
+    std::map<std::pair<int, int>, std::string> names;
+    std::mutex listMtx;
+};
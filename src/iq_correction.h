@@ -0,0 +1,187 @@
+#pragma once
+#include <dsp/types.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Time constant of the DC and imbalance estimates
+#define IQ_CORRECTION_TAU 0.25
+
+// DC offset and gain/phase imbalance correction for zero-IF operation. Runs in place on a
+// freshly converted, cache resident chunk and accumulates the moments for the next estimate
+// in the same pass. The correction is an affine map keeping I as reference:
+//   I' = I - dcI
+//   Q' = b * (Q - dcQ) + a * (I - dcI)
+// where a removes the I/Q correlation (phase error) and b equalizes the Q power (gain error).
+class IQCorrector {
+public:
+    void init(int sampleRate) {
+        this->sampleRate = sampleRate;
+        reset();
+    }
+
+    void reset() {
+        dcI = dcQ = 0.0;
+        varI = varQ = 1e-6;
+        covIQ = 0.0;
+        settled = false;
+        updateCoefs();
+    }
+
+    void process(dsp::complex_t* data, int count) {
+        if (count <= 0) { return; }
+        float* d = (float*)data;
+        int n = count * 2;
+        int i = 0;
+
+        // Lanes alternate I/Q: sum holds [sI, sQ], sq holds [sII, sQQ], cross holds [sII, sIQ]
+        float sum[2] = { 0, 0 };
+        float sq[2] = { 0, 0 };
+        float cross = 0;
+
+#if defined(__AVX512F__)
+        const __m512 mul = _mm512_setr_ps(1, b, 1, b, 1, b, 1, b, 1, b, 1, b, 1, b, 1, b);
+        const __m512 mulI = _mm512_setr_ps(0, a, 0, a, 0, a, 0, a, 0, a, 0, a, 0, a, 0, a);
+        const __m512 add = _mm512_setr_ps(c0, c1, c0, c1, c0, c1, c0, c1, c0, c1, c0, c1, c0, c1, c0, c1);
+        __m512 vSum = _mm512_setzero_ps();
+        __m512 vSq = _mm512_setzero_ps();
+        __m512 vCross = _mm512_setzero_ps();
+        for (; i + 16 <= n; i += 16) {
+            __m512 v = _mm512_loadu_ps(&d[i]);
+            __m512 vi = _mm512_moveldup_ps(v);
+            vSum = _mm512_add_ps(vSum, v);
+            vSq = _mm512_fmadd_ps(v, v, vSq);
+            vCross = _mm512_fmadd_ps(vi, v, vCross);
+            _mm512_storeu_ps(&d[i], _mm512_fmadd_ps(vi, mulI, _mm512_fmadd_ps(v, mul, add)));
+        }
+        float tSum[16], tSq[16], tCross[16];
+        _mm512_storeu_ps(tSum, vSum);
+        _mm512_storeu_ps(tSq, vSq);
+        _mm512_storeu_ps(tCross, vCross);
+        for (int k = 0; k < 16; k += 2) {
+            sum[0] += tSum[k]; sum[1] += tSum[k + 1];
+            sq[0] += tSq[k]; sq[1] += tSq[k + 1];
+            cross += tCross[k + 1];
+        }
+#elif defined(__AVX2__)
+        const __m256 mul = _mm256_setr_ps(1, b, 1, b, 1, b, 1, b);
+        const __m256 mulI = _mm256_setr_ps(0, a, 0, a, 0, a, 0, a);
+        const __m256 add = _mm256_setr_ps(c0, c1, c0, c1, c0, c1, c0, c1);
+        __m256 vSum = _mm256_setzero_ps();
+        __m256 vSq = _mm256_setzero_ps();
+        __m256 vCross = _mm256_setzero_ps();
+        for (; i + 8 <= n; i += 8) {
+            __m256 v = _mm256_loadu_ps(&d[i]);
+            __m256 vi = _mm256_moveldup_ps(v);
+            vSum = _mm256_add_ps(vSum, v);
+            vSq = _mm256_add_ps(vSq, _mm256_mul_ps(v, v));
+            vCross = _mm256_add_ps(vCross, _mm256_mul_ps(vi, v));
+            _mm256_storeu_ps(&d[i], _mm256_add_ps(_mm256_mul_ps(vi, mulI), _mm256_add_ps(_mm256_mul_ps(v, mul), add)));
+        }
+        float tSum[8], tSq[8], tCross[8];
+        _mm256_storeu_ps(tSum, vSum);
+        _mm256_storeu_ps(tSq, vSq);
+        _mm256_storeu_ps(tCross, vCross);
+        for (int k = 0; k < 8; k += 2) {
+            sum[0] += tSum[k]; sum[1] += tSum[k + 1];
+            sq[0] += tSq[k]; sq[1] += tSq[k + 1];
+            cross += tCross[k + 1];
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const float mulArr[4] = { 1, b, 1, b };
+        const float mulIArr[4] = { 0, a, 0, a };
+        const float addArr[4] = { c0, c1, c0, c1 };
+        const float32x4_t mul = vld1q_f32(mulArr);
+        const float32x4_t mulI = vld1q_f32(mulIArr);
+        const float32x4_t add = vld1q_f32(addArr);
+        float32x4_t vSum = vdupq_n_f32(0);
+        float32x4_t vSq = vdupq_n_f32(0);
+        float32x4_t vCross = vdupq_n_f32(0);
+        for (; i + 4 <= n; i += 4) {
+            float32x4_t v = vld1q_f32(&d[i]);
+            float32x4_t vi = vtrn1q_f32(v, v);
+            vSum = vaddq_f32(vSum, v);
+            vSq = vmlaq_f32(vSq, v, v);
+            vCross = vmlaq_f32(vCross, vi, v);
+            vst1q_f32(&d[i], vmlaq_f32(vmlaq_f32(add, v, mul), vi, mulI));
+        }
+        float tSum[4], tSq[4], tCross[4];
+        vst1q_f32(tSum, vSum);
+        vst1q_f32(tSq, vSq);
+        vst1q_f32(tCross, vCross);
+        for (int k = 0; k < 4; k += 2) {
+            sum[0] += tSum[k]; sum[1] += tSum[k + 1];
+            sq[0] += tSq[k]; sq[1] += tSq[k + 1];
+            cross += tCross[k + 1];
+        }
+#endif
+
+        for (; i < n; i += 2) {
+            float re = d[i];
+            float im = d[i + 1];
+            sum[0] += re; sum[1] += im;
+            sq[0] += re * re; sq[1] += im * im;
+            cross += re * im;
+            d[i] = re + c0;
+            d[i + 1] = (b * im) + (a * re) + c1;
+        }
+
+        update(count, sum, sq, cross);
+    }
+
+    // Latest estimates, for display
+    std::atomic<float> dcOffsetI{ 0 };
+    std::atomic<float> dcOffsetQ{ 0 };
+    std::atomic<float> gainImbalanceDb{ 0 };
+    std::atomic<float> phaseImbalanceDeg{ 0 };
+
+private:
+    void update(int count, const float* sum, const float* sq, float cross) {
+        double mI = sum[0] / count;
+        double mQ = sum[1] / count;
+        double vI = (sq[0] / count) - (mI * mI);
+        double vQ = (sq[1] / count) - (mQ * mQ);
+        double cIQ = (cross / count) - (mI * mQ);
+
+        // The first chunk seeds the estimates so the correction does not have to ramp up
+        double alpha = settled ? std::min<double>(1.0, (double)count / (IQ_CORRECTION_TAU * sampleRate)) : 1.0;
+        settled = true;
+        dcI += alpha * (mI - dcI);
+        dcQ += alpha * (mQ - dcQ);
+        varI += alpha * (vI - varI);
+        varQ += alpha * (vQ - varQ);
+        covIQ += alpha * (cIQ - covIQ);
+        updateCoefs();
+    }
+
+    void updateCoefs() {
+        a = 0.0f;
+        b = 1.0f;
+        if (varI > 1e-12 && varQ > 1e-12) {
+            double p = covIQ / varI;
+            double qPow = varQ - (p * covIQ);
+            if (qPow > 1e-12) {
+                double k = sqrt(varI / qPow);
+                a = (float)(-p * k);
+                b = (float)k;
+            }
+            gainImbalanceDb = (float)(10.0 * log10(varQ / varI));
+            phaseImbalanceDeg = (float)(asin(std::clamp<double>(covIQ / sqrt(varI * varQ), -1.0, 1.0)) * 180.0 / M_PI);
+        }
+        c0 = (float)-dcI;
+        c1 = (float)(-(b * dcQ) - (a * dcI));
+        dcOffsetI = (float)dcI;
+        dcOffsetQ = (float)dcQ;
+    }
+
+    int sampleRate = 1;
+    bool settled = false;
+    double dcI = 0, dcQ = 0, varI = 0, varQ = 0, covIQ = 0;
+    float a = 0, b = 1, c0 = 0, c1 = 0;
+};
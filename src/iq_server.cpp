@@ -0,0 +1,317 @@
+#include "iq_server.h"
+#include <utils/flog.h>
+#include <string.h>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// rtl_tcp commands, 1 byte opcode followed by a big endian 32 bit parameter
+enum {
+    RTLTCP_SET_FREQ = 0x01,
+    RTLTCP_SET_SAMPLE_RATE = 0x02,
+    RTLTCP_SET_GAIN_MODE = 0x03,
+    RTLTCP_SET_GAIN = 0x04,
+    RTLTCP_SET_FREQ_CORRECTION = 0x05,
+    RTLTCP_SET_AGC_MODE = 0x08,
+    RTLTCP_SET_GAIN_BY_INDEX = 0x0D,
+    RTLTCP_SET_BIAS_TEE = 0x0E
+};
+
+IqServer::IqServer() {}
+
+IqServer::~IqServer() {
+    stop();
+}
+
+bool IqServer::start(std::string host, int port, IqEncoding encoding) {
+    if (running) { return true; }
+    this->encoding = encoding;
+
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        flog::error("Could not create IQ server socket");
+        return false;
+    }
+    int one = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+        flog::error("Invalid IQ server address '{0}'", host);
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+    if (bind(listenFd, (sockaddr*)&addr, sizeof(addr)) || listen(listenFd, 4)) {
+        flog::error("Could not listen on {0}:{1}", host, port);
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+
+    ring.init(64, IQ_SERVER_SLOT);
+    bytesSent = 0;
+    clientsDropped = 0;
+    running = true;
+    ioThread = std::thread(&IqServer::ioWorker, this);
+    dispatchThread = std::thread(&IqServer::dispatchWorker, this);
+    flog::info("IQ server listening on {0}:{1}", host, port);
+    return true;
+}
+
+void IqServer::stop() {
+    if (!running) { return; }
+    running = false;
+    ring.stopReader();
+    dispatchThread.join();
+    ioThread.join();
+    ring.clearReadStop();
+    reap(true);
+    close(listenFd);
+    listenFd = -1;
+}
+
+void IqServer::push(const int16_t* buf, int count) {
+    if (!running) { return; }
+    // Nobody to send to, don't even copy
+    if (!numClients.load(std::memory_order_relaxed)) { return; }
+    while (count > 0) {
+        int n = std::min<int>(count, IQ_SERVER_SLOT);
+        int16_t* slot = ring.beginWrite();
+        if (!slot) { return; }
+        memcpy(slot, buf, n * sizeof(int16_t));
+        ring.commitWrite(n);
+        buf += n;
+        count -= n;
+    }
+}
+
+int IqServer::clientCount() {
+    return numClients.load();
+}
+
+int IqServer::encodedSize(IqEncoding encoding, int count) {
+    switch (encoding) {
+    case IQ_ENCODING_U8:
+        return count;
+    case IQ_ENCODING_PACKED12:
+        return (count / 2) * 3;
+    default:
+        return count * sizeof(int16_t);
+    }
+}
+
+int IqServer::encode(IqEncoding encoding, const int16_t* in, int count, uint8_t* out) {
+    switch (encoding) {
+    case IQ_ENCODING_U8:
+        for (int i = 0; i < count; i++) {
+            out[i] = (uint8_t)((in[i] >> 8) + 128);
+        }
+        return count;
+    case IQ_ENCODING_PACKED12:
+        // Values come in I/Q pairs, so count is always even
+        for (int i = 0; i < count; i += 2) {
+            uint16_t a = (uint16_t)(in[i] >> 4) & 0xFFF;
+            uint16_t b = (uint16_t)(in[i + 1] >> 4) & 0xFFF;
+            *out++ = a & 0xFF;
+            *out++ = (a >> 8) | ((b & 0x0F) << 4);
+            *out++ = b >> 4;
+        }
+        return (count / 2) * 3;
+    default:
+        memcpy(out, in, count * sizeof(int16_t));
+        return count * sizeof(int16_t);
+    }
+}
+
+void IqServer::dispatchWorker() {
+    while (true) {
+        SampleRing<int16_t>::Slot* slot = ring.beginRead();
+        if (!slot) { return; }
+        auto block = std::make_shared<std::vector<uint8_t>>(encodedSize(encoding, slot->count));
+        encode(encoding, slot->data, slot->count, block->data());
+        ring.endRead();
+
+        std::lock_guard<std::mutex> lck(clientsMtx);
+        for (auto& c : clients) {
+            if (c->dead) { continue; }
+            std::lock_guard<std::mutex> clck(c->mtx);
+            if (c->queue.size() >= IQ_SERVER_CLIENT_QUEUE) {
+                // The client can't keep up, waiting for it would back up into the USB thread
+                flog::warn("IQ server client {0} too slow, disconnecting", c->addr);
+                clientsDropped.fetch_add(1, std::memory_order_relaxed);
+                c->dead = true;
+            }
+            else {
+                c->queue.push_back(block);
+            }
+            c->cnd.notify_one();
+        }
+    }
+}
+
+void IqServer::clientWriter(Client* client) {
+    while (true) {
+        std::shared_ptr<std::vector<uint8_t>> block;
+        {
+            std::unique_lock<std::mutex> lck(client->mtx);
+            client->cnd.wait(lck, [client]() { return !client->queue.empty() || client->dead; });
+            if (client->dead) { return; }
+            block = client->queue.front();
+            client->queue.pop_front();
+        }
+        size_t off = 0;
+        while (off < block->size()) {
+            ssize_t ret = send(client->fd, block->data() + off, block->size() - off, MSG_NOSIGNAL);
+            if (ret <= 0) {
+                client->dead = true;
+                return;
+            }
+            off += ret;
+        }
+        bytesSent.fetch_add(off, std::memory_order_relaxed);
+    }
+}
+
+void IqServer::ioWorker() {
+    std::vector<pollfd> fds;
+    std::vector<std::shared_ptr<Client>> polled;
+    while (running) {
+        reap(false);
+
+        fds.clear();
+        polled.clear();
+        fds.push_back({ listenFd, POLLIN, 0 });
+        {
+            std::lock_guard<std::mutex> lck(clientsMtx);
+            for (auto& c : clients) {
+                fds.push_back({ c->fd, POLLIN, 0 });
+                polled.push_back(c);
+            }
+        }
+
+        // The timeout bounds how long stop() waits for this thread
+        if (poll(fds.data(), fds.size(), 100) <= 0) { continue; }
+        if (fds[0].revents & POLLIN) { accept(); }
+
+        for (int i = 0; i < (int)polled.size(); i++) {
+            if (!fds[i + 1].revents) { continue; }
+            Client* c = polled[i].get();
+            int ret = recv(c->fd, &c->cmd[c->cmdLen], sizeof(c->cmd) - c->cmdLen, 0);
+            if (ret <= 0) {
+                c->dead = true;
+                c->cnd.notify_one();
+                continue;
+            }
+            c->cmdLen += ret;
+            if (c->cmdLen == sizeof(c->cmd)) {
+                uint32_t param = ((uint32_t)c->cmd[1] << 24) | ((uint32_t)c->cmd[2] << 16) | ((uint32_t)c->cmd[3] << 8) | c->cmd[4];
+                handleCommand(c->cmd[0], param);
+                c->cmdLen = 0;
+            }
+        }
+    }
+}
+
+void IqServer::accept() {
+    sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int fd = ::accept(listenFd, (sockaddr*)&addr, &len);
+    if (fd < 0) { return; }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // Dongle info header: magic, tuner type (0 = unknown) and gain count, big endian
+    uint8_t hdr[12] = { 'R', 'T', 'L', '0' };
+    uint32_t gains = htonl(gainCount);
+    memset(&hdr[4], 0, 4);
+    memcpy(&hdr[8], &gains, 4);
+    if (send(fd, hdr, sizeof(hdr), MSG_NOSIGNAL) != sizeof(hdr)) {
+        close(fd);
+        return;
+    }
+
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+    auto client = std::make_shared<Client>();
+    client->fd = fd;
+    client->addr = std::string(ip) + ":" + std::to_string(ntohs(addr.sin_port));
+    client->writer = std::thread(&IqServer::clientWriter, this, client.get());
+    int n;
+    {
+        std::lock_guard<std::mutex> lck(clientsMtx);
+        clients.push_back(client);
+        n = clients.size();
+        numClients = n;
+    }
+    flog::info("IQ server client {0} connected", client->addr);
+    if (onClientsChanged) { onClientsChanged(n); }
+}
+
+void IqServer::handleCommand(uint8_t cmd, uint32_t param) {
+    switch (cmd) {
+    case RTLTCP_SET_FREQ:
+        if (setFrequency) { setFrequency(param); }
+        break;
+    case RTLTCP_SET_SAMPLE_RATE:
+        if (setSampleRate) { setSampleRate(param); }
+        break;
+    case RTLTCP_SET_GAIN_MODE:
+        if (setManualGain) { setManualGain(param != 0); }
+        break;
+    case RTLTCP_SET_GAIN:
+        if (setGain) { setGain((int32_t)param); }
+        break;
+    case RTLTCP_SET_GAIN_BY_INDEX:
+        if (setGain) { setGain(std::clamp<int>(param, 0, gainCount - 1) * 10); }
+        break;
+    case RTLTCP_SET_BIAS_TEE:
+        if (setBias) { setBias(param != 0); }
+        break;
+    case RTLTCP_SET_FREQ_CORRECTION:
+    case RTLTCP_SET_AGC_MODE:
+        // No RTL2832 equivalent on the MSi2500
+        break;
+    default:
+        flog::warn("IQ server ignoring unknown command {0}", (int)cmd);
+        break;
+    }
+}
+
+void IqServer::reap(bool all) {
+    std::vector<std::shared_ptr<Client>> gone;
+    int n;
+    {
+        std::lock_guard<std::mutex> lck(clientsMtx);
+        for (auto it = clients.begin(); it != clients.end();) {
+            if (all || (*it)->dead) {
+                gone.push_back(*it);
+                it = clients.erase(it);
+            }
+            else {
+                it++;
+            }
+        }
+        n = clients.size();
+        numClients = n;
+    }
+    for (auto& c : gone) {
+        {
+            std::lock_guard<std::mutex> lck(c->mtx);
+            c->dead = true;
+        }
+        c->cnd.notify_one();
+        shutdown(c->fd, SHUT_RDWR);
+        c->writer.join();
+        close(c->fd);
+        flog::info("IQ server client {0} disconnected", c->addr);
+    }
+    if (!all && !gone.empty() && onClientsChanged) { onClientsChanged(n); }
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include "ring_buffer.h"
+
+// int16 values per ring slot, larger device blocks are split
+#define IQ_SERVER_SLOT 65536
+// Encoded blocks a client may have pending before it is considered too slow and dropped
+#define IQ_SERVER_CLIENT_QUEUE 64
+
+enum IqEncoding {
+    IQ_ENCODING_U8,         // rtl_tcp's native offset binary bytes
+    IQ_ENCODING_INT16,      // Device samples as received, little endian
+    IQ_ENCODING_PACKED12    // 12 most significant bits, two values in three bytes
+};
+
+// rtl_tcp compatible IQ server. The USB callback pushes raw blocks into a ring, a dispatcher
+// thread encodes each block once and hands it to every client's bounded queue, and a writer
+// thread per client does the blocking sends. Commands from clients are decoded on the I/O
+// thread and forwarded to the handlers below.
+class IqServer {
+public:
+    IqServer();
+    ~IqServer();
+
+    bool start(std::string host, int port, IqEncoding encoding);
+    void stop();
+    bool isRunning() { return running; }
+
+    // Producer side, called from the USB callback. count is in int16 values.
+    void push(const int16_t* buf, int count);
+
+    int clientCount();
+
+    // Encodes count int16 values, returns the number of bytes written to out
+    static int encode(IqEncoding encoding, const int16_t* in, int count, uint8_t* out);
+    static int encodedSize(IqEncoding encoding, int count);
+
+    // Command handlers, run on the server's I/O thread
+    std::function<void(uint32_t)> setFrequency;
+    std::function<void(uint32_t)> setSampleRate;
+    std::function<void(bool)> setManualGain;
+    std::function<void(int)> setGain;           // Tenths of dB
+    std::function<void(bool)> setBias;
+    // Client count after a client connected or left, run on the I/O thread. Not called by stop().
+    std::function<void(int)> onClientsChanged;
+
+    // Reported to clients in the rtl_tcp header, gain by index commands map index to dB
+    int gainCount = 103;
+
+    std::atomic<uint64_t> bytesSent{ 0 };
+    std::atomic<uint64_t> clientsDropped{ 0 };
+
+private:
+    struct Client {
+        int fd;
+        std::string addr;
+        std::thread writer;
+        std::mutex mtx;
+        std::condition_variable cnd;
+        std::deque<std::shared_ptr<std::vector<uint8_t>>> queue;
+        std::atomic<bool> dead{ false };
+        uint8_t cmd[5];
+        int cmdLen = 0;
+    };
+
+    void ioWorker();
+    void dispatchWorker();
+    void clientWriter(Client* client);
+    void accept();
+    void handleCommand(uint8_t cmd, uint32_t param);
+    void reap(bool all);
+
+    SampleRing<int16_t> ring;
+    IqEncoding encoding = IQ_ENCODING_U8;
+    int listenFd = -1;
+    std::atomic<bool> running{ false };
+    std::thread ioThread;
+    std::thread dispatchThread;
+
+    std::vector<std::shared_ptr<Client>> clients;
+    std::mutex clientsMtx;
+    std::atomic<int> numClients{ 0 };
+};
@@ -0,0 +1,47 @@
+#pragma once
+#include "device.h"
+#include <mirisdr.h>
+
+class LibmirisdrDevice : public DeviceBackend {
+public:
+    LibmirisdrDevice(uint32_t index) : index(index) {}
+
+    ~LibmirisdrDevice() {
+        if (dev) { close(); }
+    }
+
+    int open() { return mirisdr_open(&dev, index); }
+
+    int close() {
+        int err = mirisdr_close(dev);
+        dev = NULL;
+        return err;
+    }
+
+    int setHwFlavour(bool sdrplay) { return mirisdr_set_hw_flavour(dev, sdrplay ? MIRISDR_HW_SDRPLAY : MIRISDR_HW_DEFAULT); }
+    int setSampleFormat(const char* format) { return mirisdr_set_sample_format(dev, (char*)format); }
+    int setTransfer(const char* transfer) { return mirisdr_set_transfer(dev, (char*)transfer); }
+    int setSampleRate(uint32_t rate) { return mirisdr_set_sample_rate(dev, rate); }
+    int setBandwidth(uint32_t bw) { return mirisdr_set_bandwidth(dev, bw); }
+    int setCenterFreq(uint32_t freq) { return mirisdr_set_center_freq(dev, freq); }
+    uint32_t getCenterFreq() { return mirisdr_get_center_freq(dev); }
+    int setOffsetTuning(bool enabled) { return mirisdr_set_offset_tuning(dev, enabled); }
+    int setIfFreq(uint32_t freq) { return mirisdr_set_if_freq(dev, freq); }
+    int setTunerGain(int gain) { return mirisdr_set_tuner_gain(dev, gain); }
+    int setMixerGain(int gain) { return mirisdr_set_mixer_gain(dev, gain); }
+    int setMixbufferGain(int gain) { return mirisdr_set_mixbuffer_gain(dev, gain); }
+    int setLnaGain(int gain) { return mirisdr_set_lna_gain(dev, gain); }
+    int setBasebandGain(int gain) { return mirisdr_set_baseband_gain(dev, gain); }
+    int setBias(bool enabled) { return mirisdr_set_bias(dev, enabled); }
+    int resetBuffer() { return mirisdr_reset_buffer(dev); }
+
+    int readAsync(DeviceReadCallback cb, void* ctx, uint32_t bufNum, uint32_t bufLen) {
+        return mirisdr_read_async(dev, cb, ctx, bufNum, bufLen);
+    }
+
+    int cancelAsync() { return mirisdr_cancel_async(dev); }
+
+private:
+    uint32_t index;
+    mirisdr_dev_t* dev = NULL;
+};
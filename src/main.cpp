@@ -10,8 +10,23 @@
 
 #include <thread>
 
+#include <memory>
+#include <condition_variable>
+#include <set>
+
 #include <mirisdr.h>
 
+#include "sample_path.h"
+#include "rates.h"
+#include "libmirisdr_device.h"
+#include "replay_device.h"
+#include "control_queue.h"
+#include "raw_recorder.h"
+#include "agc.h"
+#include "iq_server.h"
+#include "device_registry.h"
+#include "config_saver.h"
+
 #define CONCAT(a, b) ((std::string(a) + b).c_str())
 
 SDRPP_MOD_INFO{
@@ -19,31 +34,11 @@ SDRPP_MOD_INFO{
     /* Description:     */ "Mirisdr source module for SDR++",
     /* Author:          */ "cropinghigh",
     /* Version:         */ 0, 1, 2,
-    /* Max instances    */ 1
+    /* Max instances    */ -1
 };
 
 ConfigManager config;
 
-const char* sampleRatesTxt = "15MHz\00014MHz\00013MHz\00012MHz\00011MHz\00010MHz\0009MHz\0008MHz\0007MHz\0006MHz\0005MHz\0004MHz\0003MHz\0002MHz\0001.54MHz\000";
-
-const int sampleRates[] = {
-    15000000,
-    14000000,
-    13000000,
-    12000000,
-    11000000,
-    10000000,
-    9000000,
-    8000000,
-    7000000,
-    6000000,
-    5000000,
-    4000000,
-    3000000,
-    2000000,
-    1540000,
-};
-
 const char* bandwidthsTxt = "200kHz\0"
                             "300kHz\0"
                             "600kHz\0"
@@ -76,15 +71,377 @@ const int ifFreqs[] = {
     2048000,
 };
 
+const char* transfersTxt = "BULK\0"
+                          "ISOC\0";
+
+const char* transfers[] = {
+    "BULK",
+    "ISOC",
+};
+
+const char* sampleFormatsTxt = "Auto\0"
+                               "14 bit (252_S16)\0"
+                               "12 bit (336_S16)\0"
+                               "10+2 bit (384_S16)\0"
+                               "8 bit (504_S16)\0";
+
+const char* sampleFormats[] = {
+    "AUTO",
+    "252_S16",
+    "336_S16",
+    "384_S16",
+    "504_S16",
+};
+
+// Highest sample rate each format fits into the MSi2500 USB bandwidth, same limits libmirisdr uses for AUTO
+const int sampleFormatMaxRates[] = {
+    15000000,
+    6048000,
+    8064000,
+    9216000,
+    15000000,
+};
+
+// Real ADC resolution of each format
+const int sampleFormatBits[] = {
+    16,
+    14,
+    12,
+    12,
+    8,
+};
+
+const char* bufferCountsTxt = "Auto\0"
+                              "4\0"
+                              "8\0"
+                              "16\0"
+                              "32\0"
+                              "64\0";
+
+const int bufferCounts[] = {
+    0,
+    4,
+    8,
+    16,
+    32,
+    64,
+};
+
+const char* serverEncodingsTxt = "8 bit (rtl_tcp)\0"
+                                 "16 bit\0"
+                                 "Packed 12 bit\0";
+
+const char* serverEncodings[] = {
+    "u8",
+    "int16",
+    "packed12"
+};
+
+const char* decimationsTxt = "None\0"
+                             "2\0"
+                             "4\0"
+                             "8\0"
+                             "16\0"
+                             "32\0"
+                             "64\0";
+
+const int decimations[] = {
+    1, 2, 4, 8, 16, 32, 64
+};
+
+const char* channelCountsTxt = "8\0"
+                               "16\0"
+                               "32\0"
+                               "64\0"
+                               "128\0"
+                               "256\0"
+                               "512\0"
+                               "1024\0";
+
+const int channelCounts[] = {
+    8,
+    16,
+    32,
+    64,
+    128,
+    256,
+    512,
+    1024,
+};
+
+// Indexed by DiscontinuityKind
+const char* discontinuityKinds[] = {
+    "overrun",
+    "stall",
+    "retune",
+    "rateChange",
+    "restart"
+};
+
+// Adaptive buffering grows when the ring overran or the stream blocked this long in a second
+#define BUFFER_ADAPT_BLOCKED_NS 100000000ll
+// and shrinks after this many seconds without either
+#define BUFFER_ADAPT_CALM_TICKS 30
+
+// A stream without blocks for this many block periods, and at least WATCHDOG_MIN_NS, has stalled
+#define WATCHDOG_STALL_BLOCKS 20
+#define WATCHDOG_MIN_NS 1000000000ll
+// Longest wait between attempts to reopen a device that is gone
+#define WATCHDOG_MAX_BACKOFF_S 30
+
+enum ControlKey {
+    CTRL_FREQ,
+    CTRL_BANDWIDTH,
+    CTRL_OFFSET_TUNING,
+    CTRL_IF_FREQ,
+    CTRL_BIAS,
+    CTRL_TUNER_GAIN,
+    CTRL_MIXER_GAIN,
+    CTRL_MIXBUFFER_GAIN,
+    CTRL_LNA_GAIN,
+    CTRL_BASEBAND_GAIN,
+};
+
+// Settings stored per device under "devices", read from the config once when the device is
+// selected. Values are checked against the option tables and ranges, anything invalid keeps the
+// previous value.
+struct DeviceSettings {
+    int sampleRate = 1540000;
+    int srId = 14;
+    int bwId = 3;
+    bool devset_autogain = true;
+    int devset_gain = 0;
+    bool devset_hwf = false;
+    int devset_iffreq = 0;
+    bool devset_offsettuning = false;
+    int devset_mixer_gain = 0;
+    int devset_mixbuffer_gain = 0;
+    int devset_lna_gain = 0;
+    int devset_baseband_gain = 0;
+    bool devset_bias = false;
+    int ringDepth = 16;
+    int transferId = 0;
+    int formatId = 0;
+    int bufCountId = 0;
+    int bufLenId = 0;
+    int bufferProfile = BUFFER_PROFILE_MANUAL;
+    ThreadPolicy readerPolicy;
+    ThreadPolicy publisherPolicy;
+    bool lockMemory = false;
+    bool iqSwap = false;
+    bool invertSpectrum = false;
+    bool iqCorrection = false;
+    bool agcEnabled = false;
+    int agcTargetDb = -30;
+    int agcHysteresisDb = 6;
+    int agcIntervalMs = 250;
+    double clipLogRatio = 0.001;
+    int decimId = 0;
+    bool scanEnabled = false;
+    int scanStartKHz = 88000;
+    int scanStopKHz = 108000;
+    int scanStepKHz = 8000;
+    int scanDwellMs = 50;
+    int scanSettleMs = 5;
+    std::vector<uint32_t> scanList;
+    bool replayRealtime = true;
+
+    // Rate, bandwidth, buffering, threads, scan list and replay pacing fall back to their
+    // defaults when missing, the other settings carry over from the previous device
+    void load(const json& j) {
+        sampleRate = 1540000;
+        srId = 14;
+        bwId = 3;
+        bufferProfile = BUFFER_PROFILE_MANUAL;
+        readerPolicy = ThreadPolicy();
+        publisherPolicy = ThreadPolicy();
+        lockMemory = false;
+        scanList.clear();
+        replayRealtime = true;
+
+        if (j.contains("sampleRate")) {
+            int psr = j["sampleRate"];
+            int count = sizeof(sampleRates) / sizeof(sampleRates[0]);
+            for (int i = 0; i < count; i++) {
+                if (sampleRates[i] == psr) {
+                    sampleRate = psr;
+                    srId = i;
+                }
+            }
+        }
+        if (j.contains("bandwidth")) {
+            bwId = j["bandwidth"];
+            bwId = std::clamp<int>(bwId, 0, 7);
+        }
+        if (j.contains("devset_autogain")) { devset_autogain = j["devset_autogain"]; }
+        if (j.contains("devset_gain")) {
+            devset_gain = j["devset_gain"];
+            devset_gain = std::clamp<int>(devset_gain, 0, 102);
+        }
+        if (j.contains("devset_hwf")) { devset_hwf = j["devset_hwf"]; }
+        if (j.contains("devset_iffreq")) {
+            devset_iffreq = j["devset_iffreq"];
+            devset_iffreq = std::clamp<int>(devset_iffreq, 0, 3);
+        }
+        if (j.contains("devset_offsettuning")) { devset_offsettuning = j["devset_offsettuning"]; }
+        if (j.contains("devset_mixer_gain")) {
+            devset_mixer_gain = j["devset_mixer_gain"];
+            devset_mixer_gain = std::clamp<int>(devset_mixer_gain, 0, 1);
+        }
+        if (j.contains("devset_mixbuffer_gain")) {
+            devset_mixbuffer_gain = j["devset_mixbuffer_gain"];
+            devset_mixbuffer_gain = std::clamp<int>(devset_mixbuffer_gain, 0, 3);
+        }
+        if (j.contains("devset_lna_gain")) {
+            devset_lna_gain = j["devset_lna_gain"];
+            devset_lna_gain = std::clamp<int>(devset_lna_gain, 0, 1);
+        }
+        if (j.contains("devset_baseband_gain")) {
+            devset_baseband_gain = j["devset_baseband_gain"];
+            devset_baseband_gain = std::clamp<int>(devset_baseband_gain, 0, 59);
+        }
+        if (j.contains("devset_bias")) { devset_bias = j["devset_bias"]; }
+        if (j.contains("ringDepth")) {
+            ringDepth = j["ringDepth"];
+            ringDepth = std::clamp<int>(ringDepth, 2, 256);
+        }
+        if (j.contains("transfer")) {
+            std::string tr = j["transfer"];
+            for (int i = 0; i < (int)(sizeof(transfers) / sizeof(transfers[0])); i++) {
+                if (tr == transfers[i]) { transferId = i; }
+            }
+        }
+        if (j.contains("sampleFormat")) {
+            std::string fmt = j["sampleFormat"];
+            for (int i = 0; i < (int)(sizeof(sampleFormats) / sizeof(sampleFormats[0])); i++) {
+                if (fmt == sampleFormats[i]) { formatId = i; }
+            }
+        }
+        if (j.contains("bufferCount")) {
+            int cnt = j["bufferCount"];
+            for (int i = 0; i < (int)(sizeof(bufferCounts) / sizeof(bufferCounts[0])); i++) {
+                if (cnt == bufferCounts[i]) { bufCountId = i; }
+            }
+        }
+        if (j.contains("bufferLength")) {
+            int len = j["bufferLength"];
+            for (int i = 0; i < (int)(sizeof(bufferLengths) / sizeof(bufferLengths[0])); i++) {
+                if (len == bufferLengths[i]) { bufLenId = i; }
+            }
+        }
+        if (j.contains("bufferProfile")) {
+            std::string prof = j["bufferProfile"];
+            for (int i = 0; i < (int)(sizeof(bufferProfiles) / sizeof(bufferProfiles[0])); i++) {
+                if (prof == bufferProfiles[i]) { bufferProfile = i; }
+            }
+        }
+        if (j.contains("readerThread")) { readerPolicy = ThreadPolicy::fromJson(j["readerThread"]); }
+        if (j.contains("publisherThread")) { publisherPolicy = ThreadPolicy::fromJson(j["publisherThread"]); }
+        if (j.contains("lockMemory")) { lockMemory = j["lockMemory"]; }
+        if (j.contains("iqSwap")) { iqSwap = j["iqSwap"]; }
+        if (j.contains("invertSpectrum")) { invertSpectrum = j["invertSpectrum"]; }
+        if (j.contains("iqCorrection")) { iqCorrection = j["iqCorrection"]; }
+        if (j.contains("agc")) { agcEnabled = j["agc"]; }
+        if (j.contains("agcTargetDb")) {
+            agcTargetDb = j["agcTargetDb"];
+            agcTargetDb = std::clamp<int>(agcTargetDb, -60, -6);
+        }
+        if (j.contains("agcHysteresisDb")) {
+            agcHysteresisDb = j["agcHysteresisDb"];
+            agcHysteresisDb = std::clamp<int>(agcHysteresisDb, 1, 20);
+        }
+        if (j.contains("agcIntervalMs")) {
+            agcIntervalMs = j["agcIntervalMs"];
+            agcIntervalMs = std::clamp<int>(agcIntervalMs, 20, 10000);
+        }
+        if (j.contains("clipLogRatio")) {
+            clipLogRatio = j["clipLogRatio"];
+            clipLogRatio = std::clamp<double>(clipLogRatio, 0.0, 1.0);
+        }
+        if (j.contains("decimation")) {
+            int dec = j["decimation"];
+            for (int i = 0; i < (int)(sizeof(decimations) / sizeof(decimations[0])); i++) {
+                if (dec == decimations[i]) { decimId = i; }
+            }
+        }
+        if (j.contains("scan")) { scanEnabled = j["scan"]; }
+        if (j.contains("scanStartKHz")) {
+            scanStartKHz = j["scanStartKHz"];
+            scanStartKHz = std::clamp<int>(scanStartKHz, 0, 2000000);
+        }
+        if (j.contains("scanStopKHz")) {
+            scanStopKHz = j["scanStopKHz"];
+            scanStopKHz = std::clamp<int>(scanStopKHz, 0, 2000000);
+        }
+        if (j.contains("scanStepKHz")) {
+            scanStepKHz = j["scanStepKHz"];
+            scanStepKHz = std::clamp<int>(scanStepKHz, 1, 2000000);
+        }
+        if (j.contains("scanDwellMs")) {
+            scanDwellMs = j["scanDwellMs"];
+            scanDwellMs = std::clamp<int>(scanDwellMs, 1, 60000);
+        }
+        if (j.contains("scanSettleMs")) {
+            scanSettleMs = j["scanSettleMs"];
+            scanSettleMs = std::clamp<int>(scanSettleMs, 0, 1000);
+        }
+        if (j.contains("scanList")) {
+            for (auto& f : j["scanList"]) { scanList.push_back(f.get<uint32_t>()); }
+        }
+        if (j.contains("replayRealtime")) { replayRealtime = j["replayRealtime"]; }
+    }
+
+    // replayRealtime is only stored for replay devices and left to the existing entry
+    json toJson() const {
+        json j;
+        j["sampleRate"] = sampleRate;
+        j["bandwidth"] = bwId;
+        j["devset_autogain"] = devset_autogain;
+        j["devset_gain"] = devset_gain;
+        j["devset_hwf"] = devset_hwf;
+        j["devset_iffreq"] = devset_iffreq;
+        j["devset_offsettuning"] = devset_offsettuning;
+        j["devset_mixer_gain"] = devset_mixer_gain;
+        j["devset_mixbuffer_gain"] = devset_mixbuffer_gain;
+        j["devset_lna_gain"] = devset_lna_gain;
+        j["devset_baseband_gain"] = devset_baseband_gain;
+        j["devset_bias"] = devset_bias;
+        j["ringDepth"] = ringDepth;
+        j["transfer"] = transfers[transferId];
+        j["sampleFormat"] = sampleFormats[formatId];
+        j["bufferCount"] = bufferCounts[bufCountId];
+        j["bufferLength"] = bufferLengths[bufLenId];
+        j["bufferProfile"] = bufferProfiles[bufferProfile];
+        j["readerThread"] = readerPolicy.toJson();
+        j["publisherThread"] = publisherPolicy.toJson();
+        j["lockMemory"] = lockMemory;
+        j["iqSwap"] = iqSwap;
+        j["invertSpectrum"] = invertSpectrum;
+        j["iqCorrection"] = iqCorrection;
+        j["agc"] = agcEnabled;
+        j["agcTargetDb"] = agcTargetDb;
+        j["agcHysteresisDb"] = agcHysteresisDb;
+        j["agcIntervalMs"] = agcIntervalMs;
+        j["clipLogRatio"] = clipLogRatio;
+        j["decimation"] = 1 << decimId;
+        j["scan"] = scanEnabled;
+        j["scanStartKHz"] = scanStartKHz;
+        j["scanStopKHz"] = scanStopKHz;
+        j["scanStepKHz"] = scanStepKHz;
+        j["scanDwellMs"] = scanDwellMs;
+        j["scanSettleMs"] = scanSettleMs;
+        j["scanList"] = scanList;
+        return j;
+    }
+};
+
 class MirisdrSourceModule : public ModuleManager::Instance {
+    struct ChannelSource;
+
 public:
     MirisdrSourceModule(std::string name) {
         this->name = name;
 
-        // TODO Select the last samplerate option
-        sampleRate = 1540000;
-        srId = 14;
-
         handler.ctx = this;
         handler.selectHandler = menuSelected;
         handler.deselectHandler = menuDeselected;
@@ -94,19 +451,109 @@ public:
         handler.tuneHandler = tune;
         handler.stream = &stream;
 
+        DeviceRegistry::get().acquire();
         refresh();
 
+        // Each instance has its own section, the first one inherits the pre multi-instance settings.
+        // Missing fields get their defaults, the config is only written if one was added.
         config.acquire();
-        std::string confSerial = config.conf["device"];
-        config.release();
+        bool dirty = false;
+        if (!config.conf["instances"].contains(name)) {
+            config.conf["instances"][name]["device"] = config.conf["device"];
+            config.conf["instances"][name]["statsFile"] = "";
+            config.conf["instances"][name]["statsInterval"] = 5;
+            dirty = true;
+        }
+        if (!config.conf["instances"][name].contains("recordDir")) {
+            config.conf["instances"][name]["recordDir"] = core::args["root"].s() + "/recordings";
+            dirty = true;
+        }
+        if (!config.conf["instances"][name].contains("keepOpen")) {
+            config.conf["instances"][name]["keepOpen"] = false;
+            dirty = true;
+        }
+        if (!config.conf["instances"][name].contains("serverPort")) {
+            config.conf["instances"][name]["server"] = false;
+            config.conf["instances"][name]["serverHost"] = "0.0.0.0";
+            config.conf["instances"][name]["serverPort"] = 1234;
+            config.conf["instances"][name]["serverEncoding"] = "u8";
+            dirty = true;
+        }
+        if (!config.conf["instances"][name].contains("channelizer")) {
+            config.conf["instances"][name]["channelizer"] = false;
+            config.conf["instances"][name]["channelCount"] = 64;
+            config.conf["instances"][name]["channels"] = json::array();
+            dirty = true;
+        }
+        keepOpen = config.conf["instances"][name]["keepOpen"];
+        serverEnabled = config.conf["instances"][name]["server"];
+        serverPort = config.conf["instances"][name]["serverPort"];
+        std::string enc = config.conf["instances"][name]["serverEncoding"];
+        channelizerEnabled = config.conf["instances"][name]["channelizer"];
+        int chCount = config.conf["instances"][name]["channelCount"];
+        std::string confSerial = config.conf["instances"][name]["device"];
+        config.release(dirty);
+
+        for (int i = 0; i < (int)(sizeof(serverEncodings) / sizeof(serverEncodings[0])); i++) {
+            if (enc == serverEncodings[i]) { serverEncodingId = i; }
+        }
+        for (int i = 0; i < (int)(sizeof(channelCounts) / sizeof(channelCounts[0])); i++) {
+            if (chCount == channelCounts[i]) { channelCountId = i; }
+        }
+        agc.apply = [this](int control, int g) {
+            if (control == CTRL_TUNER_GAIN) {
+                postSetting(CTRL_TUNER_GAIN, "gain", [g](DeviceBackend* dev) { return dev->setTunerGain(g); });
+            }
+            else {
+                postSetting(CTRL_BASEBAND_GAIN, "baseband gain", [g](DeviceBackend* dev) { return dev->setBasebandGain(g); });
+            }
+        };
+        scanner.retune = [this](uint32_t f, uint64_t seq) {
+            postTune(f, [this, seq](bool ok) {
+                if (!ok) {
+                    scanner.onTuneFailed(seq);
+                    return;
+                }
+                // The block being captured when the tuner switched is only counted once it arrives
+                scanner.onTuned(seq, samplePath.sampleCounter.load(), blockSamples.load());
+            });
+        };
+        setupServer();
+        if (serverEnabled) { startServer(); }
         selectBySerial(confSerial);
 
-        sigpath::sourceManager.registerSource("Mirisdr", &handler);
+        // The first instance keeps the historical source name so existing setups keep working
+        sourceName = "Mirisdr";
+        if (sourceNames.count(sourceName)) { sourceName = "Mirisdr (" + name + ")"; }
+        sourceNames.insert(sourceName);
+        sigpath::sourceManager.registerSource(sourceName, &handler);
+        core::modComManager.registerInterface("mirisdr_source", name, moduleInterfaceHandler, this);
+        // Channel sources are named after the parent, so they come after it
+        if (channelizerEnabled) { loadChannels(); }
+
+        monitorThread = std::thread(&MirisdrSourceModule::monitor, this);
     }
 
     ~MirisdrSourceModule() {
+        {
+            std::lock_guard<std::mutex> lck(monitorMtx);
+            monitorStop = true;
+        }
+        monitorCnd.notify_all();
+        monitorThread.join();
+        core::modComManager.unregisterInterface(name);
+        server.stop();
         stop(this);
-        sigpath::sourceManager.unregisterSource("Mirisdr");
+        unloadChannels();
+        // Remaining int16 subscribers can't keep a destroyed instance streaming
+        {
+            std::lock_guard<std::mutex> slck(streamMtx);
+            stopStreaming();
+        }
+        if (dev) { closeDevice(); }
+        DeviceRegistry::get().release();
+        sigpath::sourceManager.unregisterSource(sourceName);
+        sourceNames.erase(sourceName);
     }
 
     void postInit() {}
@@ -127,19 +574,23 @@ public:
         devList.clear();
         devListTxt = "";
 
-        int cnt = mirisdr_get_device_count();
+        // Read the generation first so a change during the copy is picked up on the next frame
+        devListGeneration = DeviceRegistry::get().generation();
+        for (auto& name : DeviceRegistry::get().list()) {
+            devList.push_back(name);
+            devListTxt += name;
+            devListTxt += '\0';
+        }
 
-        for(int i = 0; i < cnt; i++) {
-            char manufact[256];
-            char product[256];
-            char serial[256];
-            if(!mirisdr_get_device_usb_strings(i, manufact, product, serial)) {
-                std::string name = std::string(manufact) + " " + std::string(product) + " " + std::string(serial);
-                devList.push_back(name);
-                devListTxt += name;
-                devListTxt += '\0';
-            }
+        // Raw int16 IQ captures listed in the config show up as replay devices
+        config.acquire();
+        for (auto& path : config.conf["replayFiles"]) {
+            std::string name = std::string("Replay ") + path.get<std::string>();
+            devList.push_back(name);
+            devListTxt += name;
+            devListTxt += '\0';
         }
+        config.release();
     }
 
     void selectFirst() {
@@ -151,452 +602,1714 @@ public:
     }
 
     void selectBySerial(std::string serial) {
-        if (std::find(devList.begin(), devList.end(), serial) == devList.end()) {
+        // A warm handle belongs to the previously selected device
+        if (dev && !running && serial != selectedSerial) { closeDevice(); }
+
+        auto it = std::find(devList.begin(), devList.end(), serial);
+        if (it == devList.end()) {
             selectFirst();
             return;
         }
+        devId = std::distance(devList.begin(), it);
+
+        // Changes still waiting to be saved would be read back stale
+        settingsSaver.flush();
 
-        bool created = false;
         config.acquire();
-        if (!config.conf["devices"].contains(serial)) {
-            config.conf["devices"][serial]["sampleRate"] = 1540000;
-            config.conf["devices"][serial]["bandwidth"] = 3;
-            config.conf["devices"][serial]["devset_autogain"] = devset_autogain;
-            config.conf["devices"][serial]["devset_gain"] = devset_gain;
-            config.conf["devices"][serial]["devset_hwf"] = devset_hwf;
-            config.conf["devices"][serial]["devset_iffreq"] = devset_iffreq;
-            config.conf["devices"][serial]["devset_offsettuning"] = devset_offsettuning;
-            // config.conf["devices"][serial]["devset_tuner_gain"] = 0;
-            // config.conf["devices"][serial]["devset_tuner_gain_mode"] = 0;
-            config.conf["devices"][serial]["devset_mixer_gain"] = devset_mixer_gain;
-            config.conf["devices"][serial]["devset_mixbuffer_gain"] = devset_mixbuffer_gain;
-            config.conf["devices"][serial]["devset_lna_gain"] = devset_lna_gain;
-            config.conf["devices"][serial]["devset_baseband_gain"] = devset_baseband_gain;
-            config.conf["devices"][serial]["devset_bias"] = devset_bias;
+        bool created = !config.conf["devices"].contains(serial);
+        if (created) {
+            DeviceSettings def = settings;
+            def.load(json::object());
+            config.conf["devices"][serial] = def.toJson();
+            if (serial.rfind("Replay ", 0) == 0) {
+                config.conf["devices"][serial]["replayRealtime"] = true;
+            }
         }
+        settings.load(config.conf["devices"][serial]);
         config.release(created);
+        adaptiveStep = bufferProfileSteps[BUFFER_PROFILE_ADAPTIVE];
 
-        // Set default values
-        srId = 14;
-        sampleRate = 1540000;
-        bwId = 3;
+        selectedSerial = serial;
+    }
 
-        // Load from config if available and validate
-        if (config.conf["devices"][serial].contains("sampleRate")) {
-            int psr = config.conf["devices"][serial]["sampleRate"];
-            for (int i = 0; i < 14; i++) {
-                if (sampleRates[i] == psr) {
-                    sampleRate = psr;
-                    srId = i;
-                }
-            }
-        }
-        if (config.conf["devices"][serial].contains("bandwidth")) {
-            bwId = config.conf["devices"][serial]["bandwidth"];
-            bwId = std::clamp<int>(bwId, 0, 7);
-        }
-        if (config.conf["devices"][serial].contains("devset_autogain")) {
-            devset_autogain = config.conf["devices"][serial]["devset_autogain"];
-        }
-        if (config.conf["devices"][serial].contains("devset_gain")) {
-            devset_gain = config.conf["devices"][serial]["devset_gain"];
-        }
-        if (config.conf["devices"][serial].contains("devset_hwf")) {
-            devset_hwf = config.conf["devices"][serial]["devset_hwf"];
-        }
-        if (config.conf["devices"][serial].contains("devset_iffreq")) {
-            devset_iffreq = config.conf["devices"][serial]["devset_iffreq"];
-            devset_iffreq = std::clamp<int>(devset_iffreq, 0, 3);
-        }
-        if (config.conf["devices"][serial].contains("devset_offsettuning")) {
-            devset_offsettuning = config.conf["devices"][serial]["devset_offsettuning"];
-        }
-        // if (config.conf["devices"][serial].contains("devset_tuner_gain")) {
-        //     devset_tuner_gain = config.conf["devices"][serial]["devset_tuner_gain"];
-        // }
-        // if (config.conf["devices"][serial].contains("devset_tuner_gain_mode")) {
-        //     devset_tuner_gain_mode = config.conf["devices"][serial]["devset_tuner_gain_mode"];
-        // }
-        if (config.conf["devices"][serial].contains("devset_mixer_gain")) {
-            devset_mixer_gain = config.conf["devices"][serial]["devset_mixer_gain"];
-        }
-        if (config.conf["devices"][serial].contains("devset_mixbuffer_gain")) {
-            devset_mixbuffer_gain = config.conf["devices"][serial]["devset_mixbuffer_gain"];
-        }
-        if (config.conf["devices"][serial].contains("devset_lna_gain")) {
-            devset_lna_gain = config.conf["devices"][serial]["devset_lna_gain"];
-        }
-        if (config.conf["devices"][serial].contains("devset_baseband_gain")) {
-            devset_baseband_gain = config.conf["devices"][serial]["devset_baseband_gain"];
-        }
-        if (config.conf["devices"][serial].contains("devset_bias")) {
-            devset_bias = config.conf["devices"][serial]["devset_bias"];
-        }
+    // Queues the selected device's settings for the next batched config write
+    void saveSettings() {
+        if (selectedSerial == "") { return; }
+        settingsSaver.schedule(selectedSerial, settings);
+    }
 
-        selectedSerial = serial;
+    static void commitSettings(const std::map<std::string, DeviceSettings>& batch) {
+        config.acquire();
+        for (auto& [serial, s] : batch) {
+            config.conf["devices"][serial].update(s.toJson());
+        }
+        config.release(true);
     }
 
 private:
     static void menuSelected(void* ctx) {
         MirisdrSourceModule* _this = (MirisdrSourceModule*)ctx;
-        core::setInputSampleRate(_this->sampleRate);
+        std::lock_guard<std::recursive_mutex> lck(_this->settingsMtx);
+        _this->selected = true;
+        core::setInputSampleRate(_this->effectiveSampleRate());
+        if (_this->keepOpen) { _this->warmUp(); }
         flog::info("MirisdrSourceModule '{0}': Menu Select!", _this->name);
     }
 
     static void menuDeselected(void* ctx) {
         MirisdrSourceModule* _this = (MirisdrSourceModule*)ctx;
+        std::lock_guard<std::recursive_mutex> lck(_this->settingsMtx);
+        _this->selected = false;
+        if (_this->dev && !_this->running) { _this->closeDevice(); }
         flog::info("MirisdrSourceModule '{0}': Menu Deselect!", _this->name);
     }
 
+    // Rate published to SDR++ after the optional in-module decimation
+    double effectiveSampleRate() {
+        return (double)settings.sampleRate / (double)(1 << settings.decimId);
+    }
+
     int bandwidthIdToBw(int id) {
         return bandwidths[id];
     }
 
-    static void start(void* ctx) {
-        MirisdrSourceModule* _this = (MirisdrSourceModule*)ctx;
-        if (_this->running) { return; }
-        if (_this->selectedSerial == "") {
-            flog::error("Tried to start Mirisdr source with empty serial");
-            return;
+    struct UsbGeometry {
+        int formatId;
+        int bufferCount;
+        int bufferLength; // Bytes per callback block
+        int ringDepth;
+    };
+
+    // Resolve the "Auto" entries against the selected sample rate
+    UsbGeometry resolveUsbGeometry() {
+        UsbGeometry geom;
+
+        geom.formatId = settings.formatId;
+        if (geom.formatId == 0) {
+            // Pick the highest resolution format the USB link can carry at this rate
+            geom.formatId = 4;
+            for (int i = 3; i > 0; i--) {
+                if (settings.sampleRate <= sampleFormatMaxRates[i]) { geom.formatId = i; }
+            }
         }
-        int cnt = mirisdr_get_device_count();
-        int id = -1;
-
-        for(int i = 0; i < cnt; i++) {
-            char manufact[256];
-            char product[256];
-            char serial[256];
-            if(!mirisdr_get_device_usb_strings(i, manufact, product, serial)) {
-                std::string name = std::string(manufact) + " " + std::string(product) + " " + std::string(serial);
-                if(name == _this->selectedSerial) {
-                    id = i;
-                }
+
+        int step = (settings.bufferProfile == BUFFER_PROFILE_ADAPTIVE) ? adaptiveStep.load() : bufferProfileSteps[settings.bufferProfile];
+        int lengthUs;
+        if (step >= 0) {
+            geom.bufferCount = bufferSteps[step].bufferCount;
+            geom.ringDepth = bufferSteps[step].ringDepth;
+            lengthUs = bufferSteps[step].lengthUs;
+        }
+        else {
+            geom.bufferCount = bufferCounts[settings.bufCountId];
+            if (geom.bufferCount == 0) {
+                if (settings.sampleRate <= 6000000) { geom.bufferCount = 16; }
+                else if (settings.sampleRate <= 10000000) { geom.bufferCount = 32; }
+                else { geom.bufferCount = 64; }
+            }
+
+            lengthUs = bufferLengths[settings.bufLenId];
+            if (lengthUs == 0) {
+                // Larger blocks above 8MHz keep the callback rate (and its overhead) bounded
+                lengthUs = (settings.sampleRate <= 8000000) ? 10000 : 20000;
             }
+            geom.ringDepth = settings.ringDepth;
         }
-        if(id == -1) {
-            flog::error("Mirisdr device is not available");
-            return;
+        int64_t bytes = ((int64_t)settings.sampleRate * lengthUs / 1000000) * 2 * sizeof(int16_t);
+        geom.bufferLength = (int)std::max<int64_t>(512, (bytes + 511) & ~511ll);
+
+        return geom;
+    }
+
+    void updateConvertKernel() {
+        samplePath.setKernel(selectConvertKernel(adcBits, settings.iqSwap, settings.invertSpectrum));
+        samplePath.setLevelKernel(selectLevelKernel(adcBits));
+    }
+
+    bool openDevice() {
+        if (selectedSerial.rfind("Replay ", 0) == 0) {
+            dev = std::make_unique<ReplayDevice>(selectedSerial.substr(7), settings.replayRealtime);
+        }
+        else {
+            int id = DeviceRegistry::get().indexOf(selectedSerial);
+            if(id == -1) {
+                flog::error("Mirisdr device is not available");
+                return false;
+            }
+            dev = std::make_unique<LibmirisdrDevice>(id);
         }
 
-        if(mirisdr_open(&_this->openDev, id)) {
-            flog::error("Could not open Mirisdr {0} id {1} cnt {2}", _this->selectedSerial, id, cnt);
-            return;
+        if(dev->open()) {
+            flog::error("Could not open Mirisdr {0}", selectedSerial);
+            dev.reset();
+            return false;
         }
-        if(mirisdr_set_hw_flavour(_this->openDev, _this->devset_hwf ? MIRISDR_HW_SDRPLAY : MIRISDR_HW_DEFAULT)) {
-            flog::error("Could not set Mirisdr hw flavour {0}", _this->selectedSerial);
-            return;
+        {
+            std::lock_guard<std::mutex> lck(openDevicesMtx);
+            openDevices.insert(selectedSerial);
         }
-        if(mirisdr_set_sample_format(_this->openDev, "AUTO")) {
-            flog::error("Could not set Mirisdr sample format {0}", _this->selectedSerial);
-            return;
+        applied.valid = false;
+        return true;
+    }
+
+    // Opens and configures the device ahead of start() so that starting only has to launch the transfer
+    void warmUp() {
+        if (dev || running || selectedSerial == "") { return; }
+        {
+            std::lock_guard<std::mutex> lck(openDevicesMtx);
+            if (openDevices.count(selectedSerial)) { return; }
         }
-        if(mirisdr_set_transfer(_this->openDev, "BULK")) {
-            flog::error("Could not set Mirisdr transfer {0}", _this->selectedSerial);
-            return;
+        if (!openDevice()) { return; }
+        if (!configureDevice(resolveUsbGeometry())) { closeDevice(); }
+    }
+
+    // Applies the device settings, the device must be open and not streaming. Settings already
+    // applied to the open handle are skipped unless the control thread touched them since.
+    bool configureDevice(const UsbGeometry& geom) {
+        uint32_t dirty = dirtyKeys.exchange(0);
+        AppliedSettings want;
+        want.valid = true;
+        want.hwf = settings.devset_hwf;
+        want.formatId = geom.formatId;
+        want.transferId = settings.transferId;
+        want.sampleRate = settings.sampleRate;
+        want.bandwidth = bandwidthIdToBw(settings.bwId);
+        want.freq = (uint32_t)freq;
+        want.offsetTuning = settings.devset_offsettuning;
+        want.ifFreq = ifFreqs[settings.devset_iffreq];
+        want.autogain = settings.devset_autogain;
+        want.gain = settings.devset_gain;
+        want.mixerGain = settings.devset_mixer_gain;
+        want.mixbufferGain = settings.devset_mixbuffer_gain;
+        want.lnaGain = settings.devset_lna_gain;
+        want.basebandGain = settings.devset_baseband_gain;
+        want.bias = settings.devset_bias;
+
+        // The hardware flavour changes how everything else is programmed
+        bool all = !applied.valid || applied.hwf != want.hwf;
+        applied.valid = false;
+        auto stale = [&](bool differs, int key = -1) {
+            return all || differs || (key >= 0 && (dirty & (1u << key)));
+        };
+        int changed = 0;
+
+        if (stale(false)) {
+            changed++;
+            if(dev->setHwFlavour(settings.devset_hwf)) {
+                flog::error("Could not set Mirisdr hw flavour {0}", selectedSerial);
+                return false;
+            }
         }
-        if(mirisdr_set_sample_rate(_this->openDev, _this->sampleRate)) {
-            flog::error("Could not set Mirisdr sample rate {0}", _this->selectedSerial);
-            return;
+        if (settings.sampleRate > sampleFormatMaxRates[geom.formatId]) {
+            flog::warn("Mirisdr sample format {0} cannot sustain {1} S/s, expect dropped samples", sampleFormats[geom.formatId], settings.sampleRate);
         }
-        if(mirisdr_set_bandwidth(_this->openDev, _this->bandwidthIdToBw(_this->bwId))) {
-            flog::error("Could not set Mirisdr bandwidth {0}", _this->selectedSerial);
-            return;
+        // The format selects the ADC mode the rate is programmed for, so both go together
+        bool formatChanged = stale(applied.formatId != want.formatId);
+        if (formatChanged) {
+            changed++;
+            if(dev->setSampleFormat(sampleFormats[geom.formatId])) {
+                flog::error("Could not set Mirisdr sample format {0}", selectedSerial);
+                return false;
+            }
         }
-        if(mirisdr_set_center_freq(_this->openDev, _this->freq)) {
-            flog::error("Could not set Mirisdr center freq {0}", _this->selectedSerial);
-            return;
+        if (stale(applied.transferId != want.transferId)) {
+            changed++;
+            if(dev->setTransfer(transfers[settings.transferId])) {
+                flog::error("Could not set Mirisdr transfer {0}", selectedSerial);
+                return false;
+            }
         }
-        if(mirisdr_set_offset_tuning(_this->openDev, _this->devset_offsettuning)) {
-                flog::error("Could not set Mirisdr offset tuning {0}", _this->selectedSerial);
-                return;
+        if (formatChanged || stale(applied.sampleRate != want.sampleRate)) {
+            changed++;
+            if(dev->setSampleRate(settings.sampleRate)) {
+                flog::error("Could not set Mirisdr sample rate {0}", selectedSerial);
+                return false;
             }
-        if(!_this->devset_offsettuning) {
-            if(mirisdr_set_if_freq(_this->openDev, ifFreqs[_this->devset_iffreq])) {
-                flog::error("Could not set Mirisdr if freq {0}", _this->selectedSerial);
-                return;
+        }
+        if (stale(applied.bandwidth != want.bandwidth, CTRL_BANDWIDTH)) {
+            changed++;
+            if(dev->setBandwidth(want.bandwidth)) {
+                flog::error("Could not set Mirisdr bandwidth {0}", selectedSerial);
+                return false;
             }
         }
-        if(_this->devset_autogain) {
-            if(mirisdr_set_tuner_gain(_this->openDev, _this->devset_gain)) {
-                flog::error("Could not set Mirisdr gain {0}", _this->selectedSerial);
-                return;
+        if (stale(applied.freq != want.freq, CTRL_FREQ)) {
+            changed++;
+            if(dev->setCenterFreq(freq)) {
+                flog::error("Could not set Mirisdr center freq {0}", selectedSerial);
+                return false;
+            }
+        }
+        bool offsetChanged = stale(applied.offsetTuning != want.offsetTuning, CTRL_OFFSET_TUNING);
+        if (offsetChanged) {
+            changed++;
+            if(dev->setOffsetTuning(settings.devset_offsettuning)) {
+                flog::error("Could not set Mirisdr offset tuning {0}", selectedSerial);
+                return false;
+            }
+        }
+        if(!settings.devset_offsettuning && (offsetChanged || stale(applied.ifFreq != want.ifFreq, CTRL_IF_FREQ))) {
+            changed++;
+            if(dev->setIfFreq(ifFreqs[settings.devset_iffreq])) {
+                flog::error("Could not set Mirisdr if freq {0}", selectedSerial);
+                return false;
+            }
+        }
+        bool modeChanged = stale(applied.autogain != want.autogain);
+        if(settings.devset_autogain) {
+            if (modeChanged || stale(applied.gain != want.gain, CTRL_TUNER_GAIN)) {
+                changed++;
+                if(dev->setTunerGain(settings.devset_gain)) {
+                    flog::error("Could not set Mirisdr gain {0}", selectedSerial);
+                    return false;
+                }
             }
         } else {
-            if(mirisdr_set_mixer_gain(_this->openDev, _this->devset_mixer_gain)) {
-                flog::error("Could not set Mirisdr mixer gain {0}", _this->selectedSerial);
-                return;
+            if (modeChanged || stale(applied.mixerGain != want.mixerGain, CTRL_MIXER_GAIN)) {
+                changed++;
+                if(dev->setMixerGain(settings.devset_mixer_gain)) {
+                    flog::error("Could not set Mirisdr mixer gain {0}", selectedSerial);
+                    return false;
+                }
             }
-            if(mirisdr_set_mixbuffer_gain(_this->openDev, _this->devset_mixbuffer_gain)) {
-                flog::error("Could not set Mirisdr mixbuffer gain {0}", _this->selectedSerial);
-                return;
+            if (modeChanged || stale(applied.mixbufferGain != want.mixbufferGain, CTRL_MIXBUFFER_GAIN)) {
+                changed++;
+                if(dev->setMixbufferGain(settings.devset_mixbuffer_gain)) {
+                    flog::error("Could not set Mirisdr mixbuffer gain {0}", selectedSerial);
+                    return false;
+                }
             }
-            if(mirisdr_set_lna_gain(_this->openDev, _this->devset_lna_gain)) {
-                flog::error("Could not set Mirisdr lna gain {0}", _this->selectedSerial);
-                return;
+            if (modeChanged || stale(applied.lnaGain != want.lnaGain, CTRL_LNA_GAIN)) {
+                changed++;
+                if(dev->setLnaGain(settings.devset_lna_gain)) {
+                    flog::error("Could not set Mirisdr lna gain {0}", selectedSerial);
+                    return false;
+                }
             }
-            if(mirisdr_set_baseband_gain(_this->openDev, _this->devset_baseband_gain)) {
-                flog::error("Could not set Mirisdr baseband gain {0}", _this->selectedSerial);
-                return;
+            if (modeChanged || stale(applied.basebandGain != want.basebandGain, CTRL_BASEBAND_GAIN)) {
+                changed++;
+                if(dev->setBasebandGain(settings.devset_baseband_gain)) {
+                    flog::error("Could not set Mirisdr baseband gain {0}", selectedSerial);
+                    return false;
+                }
             }
         }
-        if(mirisdr_set_bias(_this->openDev, _this->devset_bias)) {
-            flog::error("Could not set Mirisdr bias {0}", _this->selectedSerial);
-            return;
-        }
-
-        /* Reset endpoint before we start reading from it (mandatory) */
-        if(mirisdr_reset_buffer(_this->openDev)) {
-            flog::error("Failed to reset Mirisdr buffer {0}", _this->selectedSerial);
-            return;
+        if (stale(applied.bias != want.bias, CTRL_BIAS)) {
+            changed++;
+            if(dev->setBias(settings.devset_bias)) {
+                flog::error("Could not set Mirisdr bias {0}", selectedSerial);
+                return false;
+            }
         }
 
-        _this->workerThread = std::thread(mirisdr_read_async, _this->openDev, callback, _this, 0, (_this->sampleRate/50)*sizeof(int16_t));
-
-        _this->running = true;
-
-        flog::info("MirisdrSourceModule '{0}': Start!", _this->name);
+        applied = want;
+        flog::info("MirisdrSourceModule '{0}': {1} device settings applied", name, changed);
+        return true;
     }
 
-    static void stop(void* ctx) {
-        MirisdrSourceModule* _this = (MirisdrSourceModule*)ctx;
-        if (!_this->running) { return; }
-        _this->running = false;
-        if(mirisdr_cancel_async(_this->openDev)) {
-            flog::error("Mirisdr async cancel failed {0}", _this->selectedSerial);
-        }
-        _this->stream.stopWriter();
-        _this->workerThread.join();
-        int err = mirisdr_close(_this->openDev);
+    void closeDevice() {
+        applied.valid = false;
+        int err = dev->close();
         if (err) {
-            flog::error("Could not close Mirisdr {0}", _this->selectedSerial);
+            flog::error("Could not close Mirisdr {0}", selectedSerial);
+        }
+        dev.reset();
+        {
+            std::lock_guard<std::mutex> lck(openDevicesMtx);
+            openDevices.erase(selectedSerial);
         }
-        _this->stream.clearWriteStop();
-        flog::info("MirisdrSourceModule '{0}': Stop!", _this->name);
     }
 
-    static void tune(double freq, void* ctx) {
-        MirisdrSourceModule* _this = (MirisdrSourceModule*)ctx;
-        if (_this->running) {
-            if(mirisdr_set_center_freq(_this->openDev, (uint32_t)freq) || mirisdr_get_center_freq(_this->openDev) != (uint32_t)freq) {
-                flog::error("Could not set Mirisdr freq {0}(selected {1}, current {2})", _this->selectedSerial, (uint32_t)freq, mirisdr_get_center_freq(_this->openDev));
+    // Starts the device and the sample path, for the source itself or any of its channels.
+    // Called with streamMtx held.
+    bool startStreaming() {
+        if (running) { return true; }
+        if (selectedSerial == "") {
+            flog::error("Tried to start Mirisdr source with empty serial");
+            return false;
+        }
+        int64_t startTime = telemetryNow();
+        bool warm = (bool)dev;
+        if (!warm) {
+            {
+                std::lock_guard<std::mutex> lck(openDevicesMtx);
+                if (openDevices.count(selectedSerial)) {
+                    flog::error("Mirisdr {0} is already in use by another instance", selectedSerial);
+                    return false;
+                }
             }
+            if (!openDevice()) { return false; }
         }
-        _this->freq = freq;
-        flog::info("MirisdrSourceModule '{0}': Tune: {1}!", _this->name, (uint32_t)freq);
-    }
-
-    static void menuHandler(void* ctx) {
-        MirisdrSourceModule* _this = (MirisdrSourceModule*)ctx;
 
-        if (_this->running) { SmGui::BeginDisabled(); }
-        SmGui::FillWidth();
-        SmGui::ForceSync();
-        if (SmGui::Combo(CONCAT("##_mirisdr_dev_sel_", _this->name), &_this->devId, _this->devListTxt.c_str())) {
-            _this->selectBySerial(_this->devList[_this->devId]);
-            config.acquire();
-            config.conf["device"] = _this->selectedSerial;
-            config.release(true);
+        UsbGeometry geom = resolveUsbGeometry();
+        if (!configureDevice(geom)) {
+            closeDevice();
+            return false;
         }
 
-        if (SmGui::Combo(CONCAT("##_mirisdr_sr_sel_", _this->name), &_this->srId, sampleRatesTxt)) {
-            _this->sampleRate = sampleRates[_this->srId];
-            core::setInputSampleRate(_this->sampleRate);
-            config.acquire();
-            config.conf["devices"][_this->selectedSerial]["sampleRate"] = _this->sampleRate;
-            config.release(true);
+        /* Reset endpoint before we start reading from it (mandatory) */
+        if(dev->resetBuffer()) {
+            flog::error("Failed to reset Mirisdr buffer {0}", selectedSerial);
+            closeDevice();
+            return false;
         }
 
-        SmGui::SameLine();
-        SmGui::FillWidth();
-        SmGui::ForceSync();
-        if (SmGui::Button(CONCAT("Refresh##_mirisdr_refr_", _this->name))) {
-            _this->refresh();
-            _this->selectBySerial(_this->selectedSerial);
-            core::setInputSampleRate(_this->sampleRate);
+        adcBits = sampleFormatBits[geom.formatId];
+        updateConvertKernel();
+        samplePath.setDecimation(1 << settings.decimId);
+        samplePath.setCorrection(settings.iqCorrection);
+        samplePath.setAgc(NULL);
+        if (settings.agcEnabled) { startAgc(); }
+        samplePath.setScanner(NULL);
+        if (settings.scanEnabled) { startScan(); }
+        samplePath.setThreadPolicy(settings.publisherPolicy);
+        samplePath.setLockMemory(settings.lockMemory);
+        samplePath.setPublish(mainStarted);
+        samplePath.setChannelizer(NULL);
+        if (channelizerEnabled) {
+            channelizer.init(channelCounts[channelCountId], effectiveSampleRate());
+            samplePath.setChannelizer(&channelizer);
         }
+        samplePath.start(geom.ringDepth, geom.bufferLength / sizeof(int16_t), settings.sampleRate, startTime);
+        blockSamples = geom.bufferLength / (2 * sizeof(int16_t));
+        blockLengthUs = (int)(((int64_t)geom.bufferLength / (2 * sizeof(int16_t))) * 1000000 / settings.sampleRate);
+        workerThread = std::thread(&MirisdrSourceModule::reader, this, geom.bufferCount, geom.bufferLength, settings.readerPolicy);
 
-        if (SmGui::Checkbox(CONCAT("SDRPLAY HWF##_mirisdr_hwf_", _this->name), &_this->devset_hwf)) {
-            config.acquire();
-            config.conf["devices"][_this->selectedSerial]["devset_hwf"] = _this->devset_hwf;
-            config.release(true);
-        }
+        controlQueue.start();
+        startLatencyLogged = false;
+        lastOverruns = 0;
+        lastSwapBlockedNs = 0;
+        calmTicks = 0;
+        running = true;
+        if (recordRaw) { startRecording(); }
 
-        if (_this->running) { SmGui::EndDisabled(); }
+        flog::info("MirisdrSourceModule '{0}': Streaming ({1})", name, warm ? "warm" : "cold");
+        return true;
+    }
 
-        SmGui::LeftLabel("Bandwidth");
-        SmGui::FillWidth();
-        if (SmGui::Combo(CONCAT("##_mirisdr_bw_sel_", _this->name), &_this->bwId, bandwidthsTxt)) {
-            if (_this->running) {
-                if(mirisdr_set_bandwidth(_this->openDev, _this->bandwidthIdToBw(_this->bwId))) {
-                    flog::error("Could not set Mirisdr bandwidth {0}", _this->selectedSerial);
-                }
-            }
+    // Stops the device once neither the source nor any channel uses it. Called with streamMtx held.
+    void stopStreaming() {
+        if (!running) { return; }
+        running = false;
+        controlQueue.stop();
+        // The device can be missing while the watchdog waits to reopen it
+        if(dev && dev->cancelAsync()) {
+            flog::error("Mirisdr async cancel failed {0}", selectedSerial);
+        }
+        if (workerThread.joinable()) { workerThread.join(); }
+        recorder.stop();
+        samplePath.stop();
+        if (dev && !(keepOpen && selected)) { closeDevice(); }
+        uint64_t overruns = samplePath.ring.overruns.load();
+        if (overruns) {
+            flog::warn("MirisdrSourceModule '{0}': {1} blocks dropped due to ring overrun", name, overruns);
+        }
+        flog::info("MirisdrSourceModule '{0}': Streaming stopped", name);
+    }
+
+    static void start(void* ctx) {
+        MirisdrSourceModule* _this = (MirisdrSourceModule*)ctx;
+        std::lock_guard<std::recursive_mutex> lck(_this->settingsMtx);
+        std::lock_guard<std::mutex> slck(_this->streamMtx);
+        if (_this->mainStarted) { return; }
+        _this->mainStarted = true;
+        if (!_this->startStreaming()) {
+            _this->mainStarted = false;
+            return;
+        }
+        _this->samplePath.setPublish(true);
+        flog::info("MirisdrSourceModule '{0}': Start!", _this->name);
+    }
+
+    // Whether anything needs the device to stream: the source itself, a channel source, a
+    // network client or an int16 subscriber
+    bool streamUsers() {
+        return mainStarted || channelUsers || serverUser || samplePath.cs16.subscribers();
+    }
+
+    Cs16Subscriber* subscribeCs16(int depth, bool hops) {
+        std::lock_guard<std::recursive_mutex> lck(settingsMtx);
+        std::lock_guard<std::mutex> slck(streamMtx);
+        if (!startStreaming()) { return NULL; }
+        Cs16Subscriber* sub = samplePath.cs16.subscribe(depth, hops);
+        flog::info("MirisdrSourceModule '{0}': int16 {1}subscriber added ({2} total)", name, hops ? "hop " : "", samplePath.cs16.subscribers());
+        return sub;
+    }
+
+    void unsubscribeCs16(Cs16Subscriber* sub) {
+        std::lock_guard<std::recursive_mutex> lck(settingsMtx);
+        std::lock_guard<std::mutex> slck(streamMtx);
+        samplePath.cs16.unsubscribe(sub);
+        if (!streamUsers()) { stopStreaming(); }
+        flog::info("MirisdrSourceModule '{0}': int16 subscriber removed ({1} left)", name, samplePath.cs16.subscribers());
+    }
+
+    // Other modules subscribe to the raw int16 blocks, or the tagged scan hops, through the module interface
+    static void moduleInterfaceHandler(int code, void* in, void* out, void* ctx) {
+        MirisdrSourceModule* _this = (MirisdrSourceModule*)ctx;
+        if (code == MIRISDR_IFACE_CMD_SUBSCRIBE_CS16) {
+            int depth = in ? *(int*)in : CS16_DEFAULT_QUEUE;
+            *(Cs16Subscriber**)out = _this->subscribeCs16(depth, false);
+        }
+        else if (code == MIRISDR_IFACE_CMD_SUBSCRIBE_HOPS) {
+            int depth = in ? *(int*)in : CS16_DEFAULT_QUEUE;
+            *(Cs16Subscriber**)out = _this->subscribeCs16(depth, true);
+        }
+        else if (code == MIRISDR_IFACE_CMD_UNSUBSCRIBE_CS16) {
+            _this->unsubscribeCs16((Cs16Subscriber*)in);
+        }
+    }
+
+    static void stop(void* ctx) {
+        MirisdrSourceModule* _this = (MirisdrSourceModule*)ctx;
+        std::lock_guard<std::recursive_mutex> lck(_this->settingsMtx);
+        std::lock_guard<std::mutex> slck(_this->streamMtx);
+        if (!_this->mainStarted) { return; }
+        _this->mainStarted = false;
+        _this->samplePath.setPublish(false);
+        if (!_this->streamUsers()) { _this->stopStreaming(); }
+        flog::info("MirisdrSourceModule '{0}': Stop!", _this->name);
+    }
+
+    void switchSampleRate() {
+        restartTransfer(DISC_RATE_CHANGE);
+    }
+
+    // Cancels the transfer, reprograms rate, format and block size and restarts on the same handle
+    void restartTransfer(DiscontinuityKind reason) {
+        std::lock_guard<std::mutex> slck(streamMtx);
+        // Without a device the new settings are picked up when the watchdog reopens it
+        if (!running || !dev) { return; }
+        int64_t t0 = telemetryNow();
+        bool ok = true;
+        {
+            std::lock_guard<std::mutex> lck(devMtx);
+            if(dev->cancelAsync()) {
+                flog::error("Mirisdr async cancel failed {0}", selectedSerial);
+            }
+            workerThread.join();
+            samplePath.stop();
+
+            UsbGeometry geom = resolveUsbGeometry();
+            ok = configureDevice(geom) && !dev->resetBuffer();
+            // The watchdog reopens with the same settings if this fails, the rest applies either way
+            adcBits = sampleFormatBits[geom.formatId];
+            updateConvertKernel();
+            if (settings.scanEnabled) { startScan(); }
+            // A capture's header describes a single rate, continue in a new file
+            if (recorder.isRecording()) {
+                recorder.stop();
+                startRecording();
+            }
+            // Channels keep their offsets, their width follows the new rate
+            if (channelizerEnabled) { channelizer.init(channelCounts[channelCountId], effectiveSampleRate()); }
+            samplePath.markDiscontinuity(reason, samplePath.sampleCounter.load());
+            if (ok) {
+                samplePath.restart(geom.ringDepth, geom.bufferLength / sizeof(int16_t), settings.sampleRate, t0);
+                blockSamples = geom.bufferLength / (2 * sizeof(int16_t));
+                blockLengthUs = (int)(((int64_t)geom.bufferLength / (2 * sizeof(int16_t))) * 1000000 / settings.sampleRate);
+                workerThread = std::thread(&MirisdrSourceModule::reader, this, geom.bufferCount, geom.bufferLength, settings.readerPolicy);
+            }
+            else {
+                closeDevice();
+            }
+        }
+        for (auto& ch : channels) {
+            if (ch->selected) { core::setInputSampleRate(channelRate()); }
+        }
+        if (!ok) {
+            // Still running without a device, the watchdog takes over on its next tick
+            flog::error("Could not switch Mirisdr {0} to {1} S/s, reopening it", selectedSerial, settings.sampleRate);
+            nextRecovery = t0;
+            recoveryBackoffS = 1;
+            return;
+        }
+        switchLatencyLogged = false;
+        flog::info("MirisdrSourceModule '{0}': Restarted at {1} S/s with {2} us blocks in {3} ms", name, settings.sampleRate, blockLengthUs.load(), (telemetryNow() - t0) / 1e6);
+    }
+
+    // Called once per monitor tick. Detects a stream that stopped delivering (dongle reset, USB
+    // bus error) and recovers it, retrying with a growing delay while the device is gone.
+    void watchdog() {
+        // dev and running only change under streamMtx while streaming
+        std::lock_guard<std::mutex> slck(streamMtx);
+        if (!running) { return; }
+        int64_t now = telemetryNow();
+        if (!dev) {
+            if (now >= nextRecovery) { recoverDevice(); }
+            return;
+        }
+        int64_t limit = std::max<int64_t>(WATCHDOG_MIN_NS, (int64_t)blockLengthUs.load() * 1000 * WATCHDOG_STALL_BLOCKS);
+        int64_t idle = now - samplePath.lastActivity();
+        if (idle < limit) { return; }
+        flog::warn("MirisdrSourceModule '{0}': No samples from {1} for {2} ms, reopening the device", name, selectedSerial, idle / 1000000);
+        recoverDevice();
+    }
+
+    // Tears the stream down and brings it back on a newly enumerated handle for the same serial,
+    // with all device settings and the frequency reapplied. Caller holds streamMtx.
+    bool recoverDevice() {
+        if (!running) { return true; }
+        int64_t t0 = telemetryNow();
+        std::lock_guard<std::mutex> lck(devMtx);
+        if (dev) {
+            // Errors are expected here, the device may already be gone
+            dev->cancelAsync();
+            workerThread.join();
+            samplePath.stop();
+            closeDevice();
+        }
+
+        UsbGeometry geom = resolveUsbGeometry();
+        if (!openDevice() || !configureDevice(geom) || dev->resetBuffer()) {
+            if (dev) { closeDevice(); }
+            flog::warn("MirisdrSourceModule '{0}': Could not reopen {1}, retrying in {2} s", name, selectedSerial, recoveryBackoffS);
+            nextRecovery = t0 + (int64_t)recoveryBackoffS * 1000000000ll;
+            recoveryBackoffS = std::min<int>(recoveryBackoffS * 2, WATCHDOG_MAX_BACKOFF_S);
+            return false;
+        }
+
+        adcBits = sampleFormatBits[geom.formatId];
+        updateConvertKernel();
+        if (settings.scanEnabled) { startScan(); }
+        samplePath.recover(geom.ringDepth, geom.bufferLength / sizeof(int16_t), settings.sampleRate);
+        blockSamples = geom.bufferLength / (2 * sizeof(int16_t));
+        blockLengthUs = (int)(((int64_t)geom.bufferLength / (2 * sizeof(int16_t))) * 1000000 / settings.sampleRate);
+        workerThread = std::thread(&MirisdrSourceModule::reader, this, geom.bufferCount, geom.bufferLength, settings.readerPolicy);
+        recoveryBackoffS = 1;
+        outageLogged = false;
+        flog::info("MirisdrSourceModule '{0}': Reopened {1} in {2} ms", name, selectedSerial, (telemetryNow() - t0) / 1e6);
+        return true;
+    }
+
+    // Called once per monitor tick. Grows the buffers on overruns or when downstream keeps the
+    // publisher waiting, shrinks them again after a long enough quiet period.
+    void adaptBuffering() {
+        uint64_t overruns = samplePath.ring.overruns.load();
+        int64_t blocked = samplePath.stats.swapBlockedNs.load();
+        bool pressure = (overruns > lastOverruns) || (blocked - lastSwapBlockedNs > BUFFER_ADAPT_BLOCKED_NS);
+        lastOverruns = overruns;
+        lastSwapBlockedNs = blocked;
+
+        int maxStep = (sizeof(bufferSteps) / sizeof(bufferSteps[0])) - 1;
+        int step = adaptiveStep;
+        if (pressure) {
+            calmTicks = 0;
+            step = std::min<int>(step + 1, maxStep);
+        }
+        else if (++calmTicks >= BUFFER_ADAPT_CALM_TICKS) {
+            calmTicks = 0;
+            step = std::max<int>(step - 1, 0);
+        }
+        if (step == adaptiveStep) { return; }
+
+        flog::info("MirisdrSourceModule '{0}': Adaptive buffering {1} to {2} us blocks", name, (step > adaptiveStep) ? "growing" : "shrinking", bufferSteps[step].lengthUs);
+        adaptiveStep = step;
+        restartTransfer(DISC_RESTART);
+        // The new ring starts with a fresh overrun count
+        lastOverruns = 0;
+    }
+
+    // libusb events and the sample callback run on this thread
+    // The thread policy is passed in, settings belong to the threads holding settingsMtx
+    void reader(int bufCount, int bufLen, ThreadPolicy policy) {
+        applyThreadPolicy(policy, "USB reader");
+        int err = dev->readAsync(callback, this, bufCount, bufLen);
+        if (err) {
+            samplePath.stats.usbErrors.fetch_add(1, std::memory_order_relaxed);
+            flog::error("Mirisdr async read failed {0} ({1})", selectedSerial, err);
+        }
+    }
+
+    // Queues a device setting on the control thread, replacing any pending value with the same key
+    void postSetting(int key, std::string what, std::function<int(DeviceBackend*)> fn) {
+        controlQueue.post(key, [this, key, what, fn]() {
+            std::lock_guard<std::mutex> lck(devMtx);
+            // Device gone, the recovery applies the current settings
+            if (!dev) { return; }
+            dirtyKeys |= (1u << key);
+            if (fn(dev.get())) {
+                flog::error("Could not set Mirisdr {0} {1}", what, selectedSerial);
+            }
+        });
+    }
+
+    // Retunes on the control thread, done runs there once the device reports the new frequency
+    // or with false when it couldn't be tuned
+    void postTune(uint32_t target, std::function<void(bool ok)> done = NULL) {
+        int64_t posted = telemetryNow();
+        controlQueue.post(CTRL_FREQ, [this, posted, target, done]() {
+            std::unique_lock<std::mutex> lck(devMtx);
+            if (!dev) {
+                lck.unlock();
+                if (done) { done(false); }
+                return;
+            }
+            dirtyKeys |= (1u << CTRL_FREQ);
+            if(dev->setCenterFreq(target) || dev->getCenterFreq() != target) {
+                flog::error("Could not set Mirisdr freq {0}(selected {1}, current {2})", selectedSerial, target, dev->getCenterFreq());
+                lck.unlock();
+                if (done) { done(false); }
+                return;
+            }
+            lck.unlock();
+            samplePath.stats.onTune(telemetryNow() - posted);
+            // Samples before this index may still be from the old frequency
+            samplePath.markDiscontinuity(DISC_RETUNE, samplePath.sampleCounter.load());
+            if (done) { done(true); }
+        });
+    }
+
+    // rtl_tcp commands map onto the same paths as the menu. They run on the server's I/O thread
+    // under settingsMtx, the device is reached through the control queue like from the menu.
+    void setupServer() {
+        server.setFrequency = [this](uint32_t f) {
+            std::lock_guard<std::recursive_mutex> lck(settingsMtx);
+            setFrequency(f);
+        };
+        server.setSampleRate = [this](uint32_t rate) {
+            std::lock_guard<std::recursive_mutex> lck(settingsMtx);
+            int count = sizeof(sampleRates) / sizeof(sampleRates[0]);
+            int id = std::find(sampleRates, sampleRates + count, (int)rate) - sampleRates;
+            if (id == count) {
+                flog::warn("MirisdrSourceModule '{0}': Network client asked for unsupported rate {1}", name, rate);
+                return;
+            }
+            if (id == settings.srId) { return; }
+            settings.srId = id;
+            settings.sampleRate = rate;
+            if (running) { switchSampleRate(); }
+            // SDR++ is told from the UI thread
+            inputRateStale = true;
+            saveSettings();
+        };
+        server.setManualGain = [this](bool manual) {
+            std::lock_guard<std::recursive_mutex> lck(settingsMtx);
+            if (settings.agcEnabled != manual) { return; }
+            settings.agcEnabled = !manual;
+            if (running) {
+                if (settings.agcEnabled) { startAgc(); }
+                else { stopAgc(); }
+            }
+            saveSettings();
+        };
+        server.setGain = [this](int tenthDb) {
+            std::lock_guard<std::recursive_mutex> lck(settingsMtx);
+            settings.devset_gain = std::clamp<int>(tenthDb / 10, 0, 102);
+            if (running && !settings.agcEnabled) {
+                postSetting(CTRL_TUNER_GAIN, "gain", [v = settings.devset_gain](DeviceBackend* dev) { return dev->setTunerGain(v); });
+            }
+            saveSettings();
+        };
+        server.setBias = [this](bool enabled) {
+            std::lock_guard<std::recursive_mutex> lck(settingsMtx);
+            settings.devset_bias = enabled;
+            if (running) {
+                postSetting(CTRL_BIAS, "bias", [enabled](DeviceBackend* dev) { return dev->setBias(enabled); });
+            }
+            saveSettings();
+        };
+        // A headless server streams while clients are connected, like an int16 subscriber
+        server.onClientsChanged = [this](int clients) {
+            std::lock_guard<std::recursive_mutex> lck(settingsMtx);
+            setServerUser(clients > 0);
+        };
+    }
+
+    // Called with settingsMtx held
+    void setServerUser(bool use) {
+        std::lock_guard<std::mutex> slck(streamMtx);
+        if (use == serverUser) { return; }
+        serverUser = use;
+        if (use && !startStreaming()) {
+            serverUser = false;
+            return;
+        }
+        if (!use && !streamUsers()) { stopStreaming(); }
+        flog::info("MirisdrSourceModule '{0}': Network clients {1}", name, use ? "connected, streaming" : "gone");
+    }
+
+    // Called with settingsMtx held through lck. It is dropped while the server stops, the I/O
+    // thread may be waiting for it in a command handler.
+    void stopServer(std::unique_lock<std::recursive_mutex>& lck) {
+        lck.unlock();
+        server.stop();
+        lck.lock();
+        setServerUser(false);
+    }
+
+    void startServer() {
+        config.acquire();
+        std::string host = config.conf["instances"][name]["serverHost"];
+        config.release();
+        server.start(host, serverPort, (IqEncoding)serverEncodingId);
+    }
+
+    // Raw capture of the untouched device samples, named after the device, time and frequency
+    void startRecording() {
+        config.acquire();
+        std::string dir = config.conf["instances"][name]["recordDir"];
+        config.release();
+
+        time_t now = time(NULL);
+        struct tm* ltm = localtime(&now);
+        char stamp[64];
+        strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", ltm);
+        std::string serial = selectedSerial;
+        std::replace(serial.begin(), serial.end(), '/', '_');
+        std::replace(serial.begin(), serial.end(), ' ', '_');
+        std::string path = dir + "/mirisdr_" + serial + "_" + stamp + "_" + std::to_string((uint64_t)freq) + "Hz.raw";
+
+        json header;
+        header["format"] = "cs16";
+        header["adcBits"] = adcBits;
+        // The format on the wire, "Auto" resolved the same way the transfer was set up
+        header["sampleFormat"] = sampleFormats[resolveUsbGeometry().formatId];
+        header["sampleRate"] = settings.sampleRate;
+        header["centerFrequency"] = (uint64_t)freq;
+        header["bandwidth"] = bandwidthIdToBw(settings.bwId);
+        header["iqSwap"] = settings.iqSwap;
+        header["invertSpectrum"] = settings.invertSpectrum;
+        header["device"] = selectedSerial;
+        header["time"] = (int64_t)now;
+        // With the AGC on, the gain it drives is the one currently set on the device
+        bool agcActive = running && settings.agcEnabled;
+        header["gain"]["simple"] = settings.devset_autogain;
+        header["gain"]["agc"] = settings.agcEnabled;
+        header["gain"]["gain"] = (agcActive && settings.devset_autogain) ? agc.gain.load() : settings.devset_gain;
+        header["gain"]["mixerGain"] = settings.devset_mixer_gain;
+        header["gain"]["mixbufferGain"] = settings.devset_mixbuffer_gain;
+        header["gain"]["lnaGain"] = settings.devset_lna_gain;
+        header["gain"]["basebandGain"] = (agcActive && !settings.devset_autogain) ? agc.gain.load() : settings.devset_baseband_gain;
+
+        if (!recorder.start(path, header)) { return; }
+        flog::info("MirisdrSourceModule '{0}': Recording raw samples to '{1}'", name, path);
+    }
+
+    // The AGC drives the tuner gain in simple mode, the baseband gain otherwise. It runs on
+    // the publisher thread, gain changes go through the control queue like manual ones.
+    // The publisher may still be inside the AGC, it picks the restart up on its next block
+    void startAgc() {
+        agc.setTarget(settings.agcTargetDb, settings.agcHysteresisDb);
+        if (settings.devset_autogain) {
+            agc.start(CTRL_TUNER_GAIN, 0, 102, settings.devset_gain, settings.agcIntervalMs);
+        }
+        else {
+            agc.start(CTRL_BASEBAND_GAIN, 0, 59, settings.devset_baseband_gain, settings.agcIntervalMs);
+        }
+        samplePath.setAgc(&agc);
+    }
+
+    // Hands control back to the manual setting
+    void stopAgc() {
+        samplePath.setAgc(NULL);
+        if (settings.devset_autogain) {
+            postSetting(CTRL_TUNER_GAIN, "gain", [v = settings.devset_gain](DeviceBackend* dev) { return dev->setTunerGain(v); });
+        }
+        else {
+            postSetting(CTRL_BASEBAND_GAIN, "baseband gain", [v = settings.devset_baseband_gain](DeviceBackend* dev) { return dev->setBasebandGain(v); });
+        }
+    }
+
+    std::vector<uint32_t> scanFrequencies() {
+        if (!settings.scanList.empty()) { return settings.scanList; }
+        std::vector<uint32_t> freqs;
+
+        int step = std::max<int>(settings.scanStepKHz, 1);
+        for (int64_t f = settings.scanStartKHz; f <= settings.scanStopKHz; f += step) {
+            freqs.push_back((uint32_t)(f * 1000));
+        }
+        return freqs;
+    }
+
+    void startScan() {
+        std::vector<uint32_t> freqs = scanFrequencies();
+        if (freqs.empty()) {
+            flog::error("Mirisdr scan has no frequencies {0}", selectedSerial);
+            return;
+        }
+        scanner.configure(freqs, (int64_t)settings.sampleRate * settings.scanDwellMs / 1000, (int64_t)settings.sampleRate * settings.scanSettleMs / 1000);
+        samplePath.setScanner(&scanner);
+    }
+
+    void stopScan() {
+        samplePath.setScanner(NULL);
+        postTune((uint32_t)freq);
+    }
+
+    static void tune(double freq, void* ctx) {
+        MirisdrSourceModule* _this = (MirisdrSourceModule*)ctx;
+        std::lock_guard<std::recursive_mutex> lck(_this->settingsMtx);
+        _this->setFrequency(freq);
+    }
+
+    // Called with settingsMtx held
+    void setFrequency(double freq) {
+        // While scanning the hop list owns the tuner, the frequency is applied when the scan stops
+        if (running && !settings.scanEnabled) {
+            postTune((uint32_t)freq);
+        }
+        this->freq = freq;
+        flog::info("MirisdrSourceModule '{0}': Tune: {1}!", name, (uint32_t)freq);
+    }
+
+    double channelSpacing() {
+        return effectiveSampleRate() / channelCounts[channelCountId];
+    }
+
+    // Output rate of every channel source
+    double channelRate() {
+        return 2.0 * effectiveSampleRate() / channelCounts[channelCountId];
+    }
+
+    void addChannel(std::string label, double offset) {
+        auto ch = std::make_unique<ChannelSource>();
+        ch->parent = this;
+        ch->label = label;
+        ch->offset = offset;
+        ch->sourceName = sourceName + " " + label;
+        ch->handler.ctx = ch.get();
+        ch->handler.selectHandler = channelMenuSelected;
+        ch->handler.deselectHandler = channelMenuDeselected;
+        ch->handler.menuHandler = channelMenuHandler;
+        ch->handler.startHandler = channelStart;
+        ch->handler.stopHandler = channelStop;
+        ch->handler.tuneHandler = channelTune;
+        ch->handler.stream = &ch->stream;
+        sigpath::sourceManager.registerSource(ch->sourceName, &ch->handler);
+        channels.push_back(std::move(ch));
+    }
+
+    void removeChannel(int id) {
+        ChannelSource* ch = channels[id].get();
+        stopChannel(ch);
+        sigpath::sourceManager.unregisterSource(ch->sourceName);
+        channels.erase(channels.begin() + id);
+    }
+
+    void loadChannels() {
+        // A pending save would be read back stale
+        channelSaver.flush();
+        config.acquire();
+        json list = config.conf["instances"][name]["channels"];
+        config.release();
+        for (auto& c : list) {
+            addChannel(c["label"], 0.0);
+            setChannelOffset(channels.back().get(), c["offset"]);
+        }
+    }
+
+    void unloadChannels() {
+        while (!channels.empty()) { removeChannel(channels.size() - 1); }
+    }
+
+    // Queues the channel list for the next batched config write, tuning a channel saves on every step
+    void saveChannels() {
+        json list = json::array();
+        for (auto& ch : channels) {
+            json c;
+            c["label"] = ch->label;
+            c["offset"] = ch->offset;
+            list.push_back(c);
+        }
+        channelSaver.schedule(name, list);
+    }
+
+    static void commitChannels(const std::map<std::string, json>& batch) {
+        config.acquire();
+        for (auto& [instance, list] : batch) {
+            config.conf["instances"][instance]["channels"] = list;
+        }
+        config.release(true);
+    }
+
+    // The device streams while the source or any of its channels is started
+    void startChannel(ChannelSource* ch) {
+        std::lock_guard<std::mutex> slck(streamMtx);
+        if (ch->running) { return; }
+        if (!startStreaming()) { return; }
+        ch->outputId = channelizer.addOutput(ch->offset, &ch->stream);
+        ch->running = true;
+        channelUsers++;
+        flog::info("MirisdrSourceModule '{0}': Channel '{1}' started", name, ch->label);
+    }
+
+    void stopChannel(ChannelSource* ch) {
+        std::lock_guard<std::mutex> slck(streamMtx);
+        if (!ch->running) { return; }
+        // Unblocks the publisher if it waits on this channel's reader
+        ch->stream.stopWriter();
+        channelizer.removeOutput(ch->outputId);
+        ch->stream.clearWriteStop();
+        ch->running = false;
+        channelUsers--;
+        if (!streamUsers()) { stopStreaming(); }
+        flog::info("MirisdrSourceModule '{0}': Channel '{1}' stopped", name, ch->label);
+    }
+
+    // Channels sit on the filterbank grid, the offset is snapped to the nearest channel
+    void setChannelOffset(ChannelSource* ch, double offset) {
+        // Keep the whole channel inside the device band
+        double spacing = channelSpacing();
+        int maxChannel = (int)floor((effectiveSampleRate() - spacing) / 2.0 / spacing);
+        ch->offset = std::clamp<double>(Channelizer::snap(offset, spacing), -maxChannel * spacing, maxChannel * spacing);
+        if (ch->running) { channelizer.setOffset(ch->outputId, ch->offset); }
+    }
+
+    static void channelMenuSelected(void* ctx) {
+        ChannelSource* ch = (ChannelSource*)ctx;
+        std::lock_guard<std::recursive_mutex> lck(ch->parent->settingsMtx);
+        ch->selected = true;
+        core::setInputSampleRate(ch->parent->channelRate());
+        flog::info("MirisdrSourceModule '{0}': Channel '{1}' selected", ch->parent->name, ch->label);
+    }
+
+    static void channelMenuDeselected(void* ctx) {
+        ChannelSource* ch = (ChannelSource*)ctx;
+        ch->selected = false;
+    }
+
+    static void channelMenuHandler(void* ctx) {
+        ChannelSource* ch = (ChannelSource*)ctx;
+        std::lock_guard<std::recursive_mutex> lck(ch->parent->settingsMtx);
+        char buf[256];
+        snprintf(buf, sizeof(buf), "Channel of %s at %+.1f kHz, %.1f kS/s", ch->parent->sourceName.c_str(), ch->offset / 1e3, ch->parent->channelRate() / 1e3);
+        SmGui::Text(buf);
+        SmGui::Text("Device settings are in the parent source menu");
+    }
+
+    static void channelStart(void* ctx) {
+        ChannelSource* ch = (ChannelSource*)ctx;
+        std::lock_guard<std::recursive_mutex> lck(ch->parent->settingsMtx);
+        ch->parent->startChannel(ch);
+    }
+
+    static void channelStop(void* ctx) {
+        ChannelSource* ch = (ChannelSource*)ctx;
+        std::lock_guard<std::recursive_mutex> lck(ch->parent->settingsMtx);
+        ch->parent->stopChannel(ch);
+    }
+
+    // Tuning a channel moves it inside the band of the parent, whose center stays put
+    static void channelTune(double freq, void* ctx) {
+        ChannelSource* ch = (ChannelSource*)ctx;
+        std::lock_guard<std::recursive_mutex> lck(ch->parent->settingsMtx);
+        ch->parent->setChannelOffset(ch, freq - ch->parent->freq);
+        ch->parent->saveChannels();
+    }
+
+    // Picks up dongles plugged in or removed since the list was built
+    void syncDeviceList() {
+        if (DeviceRegistry::get().generation() == devListGeneration) { return; }
+        refresh();
+        auto it = std::find(devList.begin(), devList.end(), selectedSerial);
+        if (it != devList.end()) {
+            devId = std::distance(devList.begin(), it);
+            return;
+        }
+        // A running device that vanished is left to the watchdog
+        if (running) { return; }
+        // Go back to the configured device when it reappears
+        config.acquire();
+        std::string confSerial = config.conf["instances"][name]["device"];
+        config.release();
+        selectBySerial(confSerial);
+        if (selected) { core::setInputSampleRate(effectiveSampleRate()); }
+    }
+
+    static void menuHandler(void* ctx) {
+        MirisdrSourceModule* _this = (MirisdrSourceModule*)ctx;
+        // The widgets write the settings in place
+        std::unique_lock<std::recursive_mutex> lck(_this->settingsMtx);
+        _this->syncDeviceList();
+        if (_this->inputRateStale.exchange(false) && _this->selected) { core::setInputSampleRate(_this->effectiveSampleRate()); }
+
+        if (_this->running) { SmGui::BeginDisabled(); }
+        SmGui::FillWidth();
+        SmGui::ForceSync();
+        if (SmGui::Combo(CONCAT("##_mirisdr_dev_sel_", _this->name), &_this->devId, _this->devListTxt.c_str())) {
+            _this->selectBySerial(_this->devList[_this->devId]);
             config.acquire();
-            config.conf["devices"][_this->selectedSerial]["bandwidth"] = _this->bwId;
+            config.conf["instances"][_this->name]["device"] = _this->selectedSerial;
             config.release(true);
         }
 
-        if (SmGui::Checkbox(CONCAT("Offset tuning##_mirisdr_ost_", _this->name), &_this->devset_offsettuning)) {
-            if (_this->running) {
-                if(mirisdr_set_offset_tuning(_this->openDev, _this->devset_offsettuning)) {
-                    flog::error("Could not set Mirisdr offset tuning {0}", _this->selectedSerial);
-                }
-            }
+        // The rate can change while streaming, the transfer is restarted on the same handle
+        if (_this->running) { SmGui::EndDisabled(); }
+        if (SmGui::Combo(CONCAT("##_mirisdr_sr_sel_", _this->name), &_this->settings.srId, sampleRatesTxt)) {
+            _this->settings.sampleRate = sampleRates[_this->settings.srId];
+            if (_this->running) { _this->switchSampleRate(); }
+            if (_this->selected) { core::setInputSampleRate(_this->effectiveSampleRate()); }
+            _this->saveSettings();
+        }
+        if (_this->running) { SmGui::BeginDisabled(); }
+
+        SmGui::SameLine();
+        SmGui::FillWidth();
+        SmGui::ForceSync();
+        if (SmGui::Button(CONCAT("Refresh##_mirisdr_refr_", _this->name))) {
+            DeviceRegistry::get().rescan();
+            _this->refresh();
+            _this->selectBySerial(_this->selectedSerial);
+            if (_this->selected) { core::setInputSampleRate(_this->effectiveSampleRate()); }
+        }
+
+        if (SmGui::Checkbox(CONCAT("Keep device open##_mirisdr_keep_", _this->name), &_this->keepOpen)) {
+            if (_this->keepOpen) { _this->warmUp(); }
+            else if (_this->dev && !_this->running) { _this->closeDevice(); }
             config.acquire();
-            config.conf["devices"][_this->selectedSerial]["devset_offsettuning"] = _this->devset_offsettuning;
+            config.conf["instances"][_this->name]["keepOpen"] = _this->keepOpen;
             config.release(true);
         }
 
-        if(_this->devset_offsettuning) { SmGui::BeginDisabled(); }
+        if (SmGui::Checkbox(CONCAT("SDRPLAY HWF##_mirisdr_hwf_", _this->name), &_this->settings.devset_hwf)) {
+            _this->saveSettings();
+        }
+
+        SmGui::LeftLabel("Decimation");
+        SmGui::FillWidth();
+        if (SmGui::Combo(CONCAT("##_mirisdr_decim_", _this->name), &_this->settings.decimId, decimationsTxt)) {
+            if (_this->selected) { core::setInputSampleRate(_this->effectiveSampleRate()); }
+            _this->saveSettings();
+        }
+
+        SmGui::LeftLabel("Transfer");
+        SmGui::FillWidth();
+        if (SmGui::Combo(CONCAT("##_mirisdr_transfer_", _this->name), &_this->settings.transferId, transfersTxt)) {
+            _this->saveSettings();
+        }
+
+        SmGui::LeftLabel("Format");
+        SmGui::FillWidth();
+        if (SmGui::Combo(CONCAT("##_mirisdr_format_", _this->name), &_this->settings.formatId, sampleFormatsTxt)) {
+            _this->saveSettings();
+        }
+
+        SmGui::LeftLabel("Buffering");
+        SmGui::FillWidth();
+        if (SmGui::Combo(CONCAT("##_mirisdr_bufprof_", _this->name), &_this->settings.bufferProfile, bufferProfilesTxt)) {
+            _this->adaptiveStep = bufferProfileSteps[BUFFER_PROFILE_ADAPTIVE];
+            _this->saveSettings();
+        }
+
+        if (_this->settings.bufferProfile == BUFFER_PROFILE_MANUAL) {
+            SmGui::LeftLabel("USB buffers");
+            SmGui::FillWidth();
+            if (SmGui::Combo(CONCAT("##_mirisdr_bufcnt_", _this->name), &_this->settings.bufCountId, bufferCountsTxt)) {
+                _this->saveSettings();
+            }
+
+            SmGui::LeftLabel("Block length");
+            SmGui::FillWidth();
+            if (SmGui::Combo(CONCAT("##_mirisdr_buflen_", _this->name), &_this->settings.bufLenId, bufferLengthsTxt)) {
+                _this->saveSettings();
+            }
+        }
+
+        if (_this->running) { SmGui::EndDisabled(); }
+
+        SmGui::LeftLabel("Bandwidth");
+        SmGui::FillWidth();
+        if (SmGui::Combo(CONCAT("##_mirisdr_bw_sel_", _this->name), &_this->settings.bwId, bandwidthsTxt)) {
+            if (_this->running) {
+                _this->postSetting(CTRL_BANDWIDTH, "bandwidth", [v = _this->bandwidthIdToBw(_this->settings.bwId)](DeviceBackend* dev) { return dev->setBandwidth(v); });
+            }
+            _this->saveSettings();
+        }
+
+        if (SmGui::Checkbox(CONCAT("Offset tuning##_mirisdr_ost_", _this->name), &_this->settings.devset_offsettuning)) {
+            if (_this->running) {
+                _this->postSetting(CTRL_OFFSET_TUNING, "offset tuning", [v = _this->settings.devset_offsettuning](DeviceBackend* dev) { return dev->setOffsetTuning(v); });
+            }
+            _this->saveSettings();
+        }
+
+        if(_this->settings.devset_offsettuning) { SmGui::BeginDisabled(); }
         SmGui::LeftLabel("IF Freq");
         SmGui::FillWidth();
-        if (SmGui::Combo(CONCAT("##_mirisdr_iffreq_", _this->name), &_this->devset_iffreq, ifFreqsTxt)) {
+        if (SmGui::Combo(CONCAT("##_mirisdr_iffreq_", _this->name), &_this->settings.devset_iffreq, ifFreqsTxt)) {
             if (_this->running) {
-                if(mirisdr_set_if_freq(_this->openDev, ifFreqs[_this->devset_iffreq])) {
-                    flog::error("Could not set Mirisdr if freq {0}", _this->selectedSerial);
-                }
+                _this->postSetting(CTRL_IF_FREQ, "if freq", [v = ifFreqs[_this->settings.devset_iffreq]](DeviceBackend* dev) { return dev->setIfFreq(v); });
             }
-            config.acquire();
-            config.conf["devices"][_this->selectedSerial]["devset_iffreq"] = _this->devset_iffreq;
-            config.release(true);
+            _this->saveSettings();
+        }
+        if(_this->settings.devset_offsettuning) { SmGui::EndDisabled(); }
+
+        if (SmGui::Checkbox(CONCAT("Swap I/Q##_mirisdr_iqswap_", _this->name), &_this->settings.iqSwap)) {
+            _this->updateConvertKernel();
+            _this->saveSettings();
+        }
+        SmGui::SameLine();
+        if (SmGui::Checkbox(CONCAT("Invert spectrum##_mirisdr_inv_", _this->name), &_this->settings.invertSpectrum)) {
+            _this->updateConvertKernel();
+            _this->saveSettings();
+        }
+        if (SmGui::Checkbox(CONCAT("DC/IQ correction##_mirisdr_iqcorr_", _this->name), &_this->settings.iqCorrection)) {
+            _this->samplePath.setCorrection(_this->settings.iqCorrection);
+            _this->saveSettings();
         }
-        if(_this->devset_offsettuning) { SmGui::EndDisabled(); }
 
-        if (SmGui::Checkbox(CONCAT("Bias##_mirisdr_bias_", _this->name), &_this->devset_bias)) {
+        if (SmGui::Checkbox(CONCAT("Bias##_mirisdr_bias_", _this->name), &_this->settings.devset_bias)) {
             if (_this->running) {
-                if(mirisdr_set_bias(_this->openDev, _this->devset_bias)) {
-                    flog::error("Could not set Mirisdr bias {0}", _this->selectedSerial);
-                }
+                _this->postSetting(CTRL_BIAS, "bias", [v = _this->settings.devset_bias](DeviceBackend* dev) { return dev->setBias(v); });
             }
-            config.acquire();
-            config.conf["devices"][_this->selectedSerial]["devset_bias"] = _this->devset_bias;
-            config.release(true);
+            _this->saveSettings();
         }
 
-        if (SmGui::Checkbox(CONCAT("Simple gain##_mirisdr_bias_", _this->name), &_this->devset_autogain)) {
+        if (SmGui::Checkbox(CONCAT("Simple gain##_mirisdr_bias_", _this->name), &_this->settings.devset_autogain)) {
             if (_this->running) {
-                if(_this->devset_autogain) {
-                    if(mirisdr_set_tuner_gain(_this->openDev, _this->devset_gain)) {
-                        flog::error("Could not set Mirisdr gain {0}", _this->selectedSerial);
-                    }
+                if(_this->settings.devset_autogain) {
+                    _this->postSetting(CTRL_TUNER_GAIN, "gain", [v = _this->settings.devset_gain](DeviceBackend* dev) { return dev->setTunerGain(v); });
                 } else {
-                    if(mirisdr_set_mixer_gain(_this->openDev, _this->devset_mixer_gain)) {
-                        flog::error("Could not set Mirisdr mixer gain {0}", _this->selectedSerial);
-                    }
-                    if(mirisdr_set_mixbuffer_gain(_this->openDev, _this->devset_mixbuffer_gain)) {
-                        flog::error("Could not set Mirisdr mixbuffer gain {0}", _this->selectedSerial);
-                    }
-                    if(mirisdr_set_lna_gain(_this->openDev, _this->devset_lna_gain)) {
-                        flog::error("Could not set Mirisdr lna gain {0}", _this->selectedSerial);
-                    }
-                    if(mirisdr_set_baseband_gain(_this->openDev, _this->devset_baseband_gain)) {
-                        flog::error("Could not set Mirisdr baseband gain {0}", _this->selectedSerial);
-                    }
+                    _this->postSetting(CTRL_MIXER_GAIN, "mixer gain", [v = _this->settings.devset_mixer_gain](DeviceBackend* dev) { return dev->setMixerGain(v); });
+                    _this->postSetting(CTRL_MIXBUFFER_GAIN, "mixbuffer gain", [v = _this->settings.devset_mixbuffer_gain](DeviceBackend* dev) { return dev->setMixbufferGain(v); });
+                    _this->postSetting(CTRL_LNA_GAIN, "lna gain", [v = _this->settings.devset_lna_gain](DeviceBackend* dev) { return dev->setLnaGain(v); });
+                    _this->postSetting(CTRL_BASEBAND_GAIN, "baseband gain", [v = _this->settings.devset_baseband_gain](DeviceBackend* dev) { return dev->setBasebandGain(v); });
                 }
             }
-            config.acquire();
-            config.conf["devices"][_this->selectedSerial]["devset_autogain"] = _this->devset_autogain;
-            config.release(true);
+            if (_this->running && _this->settings.agcEnabled) { _this->startAgc(); }
+            _this->saveSettings();
+        }
+
+        if (SmGui::Checkbox(CONCAT("AGC##_mirisdr_agc_", _this->name), &_this->settings.agcEnabled)) {
+            if (_this->running) {
+                if (_this->settings.agcEnabled) { _this->startAgc(); }
+                else { _this->stopAgc(); }
+            }
+            _this->saveSettings();
+        }
+        if (_this->settings.agcEnabled) {
+            SmGui::LeftLabel("AGC target (dBFS)");
+            SmGui::FillWidth();
+            if (SmGui::SliderInt(CONCAT("##_mirisdr_agc_target_", _this->name), &_this->settings.agcTargetDb, -60, -6)) {
+                _this->agc.setTarget(_this->settings.agcTargetDb, _this->settings.agcHysteresisDb);
+                _this->saveSettings();
+            }
         }
-        
-        if(_this->devset_autogain) {
+
+        if (_this->running) { _this->overloadIndicator(); }
+
+        // The slider driven by the AGC follows it and can't be moved by hand
+        bool agcActive = _this->running && _this->settings.agcEnabled;
+        if (agcActive) { _this->agcGainView = _this->agc.gain; }
+        if(_this->settings.devset_autogain) {
             SmGui::LeftLabel("Gain");
             SmGui::FillWidth();
-            if (SmGui::SliderInt(CONCAT("##_mirisdr_gain_", _this->name), &_this->devset_gain, 0, 102)) {
+            if (agcActive) { SmGui::BeginDisabled(); }
+            if (SmGui::SliderInt(CONCAT("##_mirisdr_gain_", _this->name), agcActive ? &_this->agcGainView : &_this->settings.devset_gain, 0, 102)) {
                 if (_this->running) {
-                    if(mirisdr_set_tuner_gain(_this->openDev, _this->devset_gain)) {
-                        flog::error("Could not set Mirisdr gain {0}", _this->selectedSerial);
-                    }
+                    _this->postSetting(CTRL_TUNER_GAIN, "gain", [v = _this->settings.devset_gain](DeviceBackend* dev) { return dev->setTunerGain(v); });
                 }
-                config.acquire();
-                config.conf["devices"][_this->selectedSerial]["devset_gain"] = (int)_this->devset_gain;
-                config.release(true);
+                _this->saveSettings();
             }
+            if (agcActive) { SmGui::EndDisabled(); }
         } else {
             SmGui::LeftLabel("Mixer gain");
             SmGui::FillWidth();
-            if (SmGui::SliderInt(CONCAT("##_mirisdr_mgain_", _this->name), &_this->devset_mixer_gain, 0, 1)) {
+            if (SmGui::SliderInt(CONCAT("##_mirisdr_mgain_", _this->name), &_this->settings.devset_mixer_gain, 0, 1)) {
                 if (_this->running) {
-                    if(mirisdr_set_mixer_gain(_this->openDev, _this->devset_mixer_gain)) {
-                        flog::error("Could not set Mirisdr mixer gain {0}", _this->selectedSerial);
-                    }
+                    _this->postSetting(CTRL_MIXER_GAIN, "mixer gain", [v = _this->settings.devset_mixer_gain](DeviceBackend* dev) { return dev->setMixerGain(v); });
                 }
-                config.acquire();
-                config.conf["devices"][_this->selectedSerial]["devset_mixer_gain"] = (int)_this->devset_mixer_gain;
-                config.release(true);
+                _this->saveSettings();
             }
             SmGui::LeftLabel("Mixbuffer gain");
             SmGui::FillWidth();
-            if (SmGui::SliderInt(CONCAT("##_mirisdr_mbgain_", _this->name), &_this->devset_mixbuffer_gain, 0, 3)) {
+            if (SmGui::SliderInt(CONCAT("##_mirisdr_mbgain_", _this->name), &_this->settings.devset_mixbuffer_gain, 0, 3)) {
                 if (_this->running) {
-                    if(mirisdr_set_mixbuffer_gain(_this->openDev, _this->devset_mixbuffer_gain)) {
-                        flog::error("Could not set Mirisdr mixbuffer gain {0}", _this->selectedSerial);
-                    }
+                    _this->postSetting(CTRL_MIXBUFFER_GAIN, "mixbuffer gain", [v = _this->settings.devset_mixbuffer_gain](DeviceBackend* dev) { return dev->setMixbufferGain(v); });
                 }
-                config.acquire();
-                config.conf["devices"][_this->selectedSerial]["devset_mixbuffer_gain"] = (int)_this->devset_mixbuffer_gain;
-                config.release(true);
+                _this->saveSettings();
             }
             SmGui::LeftLabel("LNA gain");
             SmGui::FillWidth();
-            if (SmGui::SliderInt(CONCAT("##_mirisdr_lgain_", _this->name), &_this->devset_lna_gain, 0, 1)) {
+            if (SmGui::SliderInt(CONCAT("##_mirisdr_lgain_", _this->name), &_this->settings.devset_lna_gain, 0, 1)) {
                 if (_this->running) {
-                    if(mirisdr_set_lna_gain(_this->openDev, _this->devset_lna_gain)) {
-                        flog::error("Could not set Mirisdr lna gain {0}", _this->selectedSerial);
-                    }
+                    _this->postSetting(CTRL_LNA_GAIN, "lna gain", [v = _this->settings.devset_lna_gain](DeviceBackend* dev) { return dev->setLnaGain(v); });
                 }
-                config.acquire();
-                config.conf["devices"][_this->selectedSerial]["devset_lna_gain"] = (int)_this->devset_lna_gain;
-                config.release(true);
+                _this->saveSettings();
             }
             SmGui::LeftLabel("Baseband gain");
             SmGui::FillWidth();
-            if (SmGui::SliderInt(CONCAT("##_mirisdr_bbgain_", _this->name), &_this->devset_baseband_gain, 0, 59)) {
+            if (agcActive) { SmGui::BeginDisabled(); }
+            if (SmGui::SliderInt(CONCAT("##_mirisdr_bbgain_", _this->name), agcActive ? &_this->agcGainView : &_this->settings.devset_baseband_gain, 0, 59)) {
                 if (_this->running) {
-                    if(mirisdr_set_baseband_gain(_this->openDev, _this->devset_baseband_gain)) {
-                        flog::error("Could not set Mirisdr baseband gain {0}", _this->selectedSerial);
-                    }
+                    _this->postSetting(CTRL_BASEBAND_GAIN, "baseband gain", [v = _this->settings.devset_baseband_gain](DeviceBackend* dev) { return dev->setBasebandGain(v); });
                 }
+                _this->saveSettings();
+            }
+            if (agcActive) { SmGui::EndDisabled(); }
+        }
+
+        if (SmGui::Checkbox(CONCAT("Scan##_mirisdr_scan_", _this->name), &_this->settings.scanEnabled)) {
+            if (_this->running) {
+                if (_this->settings.scanEnabled) { _this->startScan(); }
+                else { _this->stopScan(); }
+            }
+            _this->saveSettings();
+        }
+        if (_this->settings.scanEnabled) {
+            // Range and timing only take effect when the scan is (re)started
+            if (_this->running) { SmGui::BeginDisabled(); }
+            SmGui::LeftLabel("Start (kHz)");
+            SmGui::FillWidth();
+            if (SmGui::InputInt(CONCAT("##_mirisdr_scan_start_", _this->name), &_this->settings.scanStartKHz, 100, 1000)) {
+                _this->settings.scanStartKHz = std::clamp<int>(_this->settings.scanStartKHz, 0, 2000000);
+                _this->saveSettings();
+            }
+            SmGui::LeftLabel("Stop (kHz)");
+            SmGui::FillWidth();
+            if (SmGui::InputInt(CONCAT("##_mirisdr_scan_stop_", _this->name), &_this->settings.scanStopKHz, 100, 1000)) {
+                _this->settings.scanStopKHz = std::clamp<int>(_this->settings.scanStopKHz, 0, 2000000);
+                _this->saveSettings();
+            }
+            SmGui::LeftLabel("Step (kHz)");
+            SmGui::FillWidth();
+            if (SmGui::InputInt(CONCAT("##_mirisdr_scan_step_", _this->name), &_this->settings.scanStepKHz, 100, 1000)) {
+                _this->settings.scanStepKHz = std::clamp<int>(_this->settings.scanStepKHz, 1, 2000000);
+                _this->saveSettings();
+            }
+            SmGui::LeftLabel("Dwell (ms)");
+            SmGui::FillWidth();
+            if (SmGui::InputInt(CONCAT("##_mirisdr_scan_dwell_", _this->name), &_this->settings.scanDwellMs, 1, 10)) {
+                _this->settings.scanDwellMs = std::clamp<int>(_this->settings.scanDwellMs, 1, 60000);
+                _this->saveSettings();
+            }
+            SmGui::LeftLabel("Settle (ms)");
+            SmGui::FillWidth();
+            if (SmGui::InputInt(CONCAT("##_mirisdr_scan_settle_", _this->name), &_this->settings.scanSettleMs, 1, 10)) {
+                _this->settings.scanSettleMs = std::clamp<int>(_this->settings.scanSettleMs, 0, 1000);
+                _this->saveSettings();
+            }
+            if (_this->running) { SmGui::EndDisabled(); }
+
+            char buf[128];
+            snprintf(buf, sizeof(buf), "Hops/s: %.1f (max %.1f)", _this->hopsPerSecond.load(), _this->maxHopsPerSecond());
+            SmGui::Text(buf);
+        }
+
+        if (SmGui::Checkbox(CONCAT("Record raw IQ##_mirisdr_rec_", _this->name), &_this->recordRaw)) {
+            if (_this->running) {
+                if (_this->recordRaw) { _this->startRecording(); }
+                else { _this->recorder.stop(); }
+            }
+        }
+        if (_this->recorder.isRecording()) {
+            char buf[128];
+            snprintf(buf, sizeof(buf), "Recorded: %.1f MB (dropped %.1f MB)", _this->recorder.bytesWritten.load() / 1e6, _this->recorder.bytesDropped.load() / 1e6);
+            SmGui::Text(buf);
+        }
+
+        if (SmGui::Checkbox(CONCAT("Network server##_mirisdr_srv_", _this->name), &_this->serverEnabled)) {
+            if (_this->serverEnabled) { _this->startServer(); }
+            else { _this->stopServer(lck); }
+            config.acquire();
+            config.conf["instances"][_this->name]["server"] = _this->serverEnabled;
+            config.release(true);
+        }
+        if (_this->serverEnabled) {
+            // Port and encoding apply when the server (re)starts
+            bool listening = _this->server.isRunning();
+            if (listening) { SmGui::BeginDisabled(); }
+            SmGui::LeftLabel("Port");
+            SmGui::FillWidth();
+            if (SmGui::InputInt(CONCAT("##_mirisdr_srv_port_", _this->name), &_this->serverPort, 1, 100)) {
+                _this->serverPort = std::clamp<int>(_this->serverPort, 1, 65535);
+                config.acquire();
+                config.conf["instances"][_this->name]["serverPort"] = _this->serverPort;
+                config.release(true);
+            }
+            SmGui::LeftLabel("Encoding");
+            SmGui::FillWidth();
+            if (SmGui::Combo(CONCAT("##_mirisdr_srv_enc_", _this->name), &_this->serverEncodingId, serverEncodingsTxt)) {
                 config.acquire();
-                config.conf["devices"][_this->selectedSerial]["devset_baseband_gain"] = (int)_this->devset_baseband_gain;
+                config.conf["instances"][_this->name]["serverEncoding"] = serverEncodings[_this->serverEncodingId];
+                config.release(true);
+            }
+            if (listening) { SmGui::EndDisabled(); }
+
+            char buf[128];
+            snprintf(buf, sizeof(buf), "Clients: %d, sent %.1f MB, dropped %llu", _this->server.clientCount(), _this->server.bytesSent.load() / 1e6, (unsigned long long)_this->server.clientsDropped.load());
+            SmGui::Text(buf);
+        }
+
+        // The channel grid is fixed while streaming, channels can be added and retuned any time
+        if (_this->running) { SmGui::BeginDisabled(); }
+        if (SmGui::Checkbox(CONCAT("Channelizer##_mirisdr_chan_", _this->name), &_this->channelizerEnabled)) {
+            if (_this->channelizerEnabled) { _this->loadChannels(); }
+            else { _this->unloadChannels(); }
+            config.acquire();
+            config.conf["instances"][_this->name]["channelizer"] = _this->channelizerEnabled;
+            config.release(true);
+        }
+        if (_this->channelizerEnabled) {
+            SmGui::LeftLabel("Channels");
+            SmGui::FillWidth();
+            if (SmGui::Combo(CONCAT("##_mirisdr_chan_cnt_", _this->name), &_this->channelCountId, channelCountsTxt)) {
+                config.acquire();
+                config.conf["instances"][_this->name]["channelCount"] = channelCounts[_this->channelCountId];
                 config.release(true);
             }
         }
+        if (_this->running) { SmGui::EndDisabled(); }
+        if (_this->channelizerEnabled) {
+            char buf[128];
+            double spacing = _this->channelSpacing();
+            snprintf(buf, sizeof(buf), "Channel width %.1f kHz, %.1f kS/s", spacing / 1e3, _this->channelRate() / 1e3);
+            SmGui::Text(buf);
+            SmGui::Text("Channels sit on the width grid, offsets snap to it");
+            for (int i = 0; i < (int)_this->channels.size(); i++) {
+                ChannelSource* ch = _this->channels[i].get();
+                std::string id = _this->name + "_" + ch->label;
+                // Edited as a position on the grid, kHz steps would snap back
+                int index = (int)lround(ch->offset / spacing);
+                snprintf(buf, sizeof(buf), "%s %+.1f kHz", ch->label.c_str(), ch->offset / 1e3);
+                SmGui::LeftLabel(buf);
+                SmGui::FillWidth();
+                if (SmGui::InputInt(("##_mirisdr_chan_off_" + id).c_str(), &index, 1, 10)) {
+                    _this->setChannelOffset(ch, index * spacing);
+                    _this->saveChannels();
+                }
+                if (SmGui::Button(("Remove " + ch->label + "##_mirisdr_chan_rm_" + id).c_str())) {
+                    _this->removeChannel(i);
+                    _this->saveChannels();
+                    break;
+                }
+            }
+            SmGui::LeftLabel("Offset (kHz)");
+            SmGui::FillWidth();
+            SmGui::InputInt(CONCAT("##_mirisdr_chan_new_", _this->name), &_this->newChannelOffsetKHz, 1, 100);
+            if (SmGui::Button(CONCAT("Add channel##_mirisdr_chan_add_", _this->name))) {
+                // Labels stay unique, they name the registered source
+                int n = 1;
+                while (std::any_of(_this->channels.begin(), _this->channels.end(), [n](const auto& c) { return c->label == "CH" + std::to_string(n); })) { n++; }
+                _this->addChannel("CH" + std::to_string(n), 0.0);
+                _this->setChannelOffset(_this->channels.back().get(), _this->newChannelOffsetKHz * 1e3);
+                _this->saveChannels();
+            }
+        }
+
+        SmGui::Checkbox(CONCAT("Statistics##_mirisdr_stats_", _this->name), &_this->showStats);
+        if (_this->showStats) { _this->statsMenu(); }
+    }
+
+    // Green while no value reaches the top ADC codes, yellow on occasional clipping, red above the log ratio
+    void overloadIndicator() {
+        char buf[64];
+        double ratio = samplePath.stats.clipRatio.load();
+        snprintf(buf, sizeof(buf), "ADC: %.1f dBFS peak, %.3f%% clipped", samplePath.stats.peakDbfs.load(), ratio * 100.0);
+        if (overloaded) {
+            SmGui::TextColored(ImVec4(1.0f, 0.2f, 0.2f, 1.0f), buf);
+        }
+        else if (ratio > 0.0) {
+            SmGui::TextColored(ImVec4(1.0f, 0.8f, 0.0f, 1.0f), buf);
+        }
+        else {
+            SmGui::TextColored(ImVec4(0.2f, 0.9f, 0.2f, 1.0f), buf);
+        }
+    }
+
+    void statsMenu() {
+        Telemetry& st = samplePath.stats;
+        char buf[128];
+        snprintf(buf, sizeof(buf), "Rate: %.3f MS/s", st.samplesPerSecond.load() / 1e6);
+        SmGui::Text(buf);
+        snprintf(buf, sizeof(buf), "Queue: %d/%d (peak %d)", samplePath.ring.fill(), samplePath.ring.depth(), st.peakQueueDepth.load());
+        SmGui::Text(buf);
+        snprintf(buf, sizeof(buf), "Block length: %.1f ms", blockLengthUs.load() / 1000.0);
+        SmGui::Text(buf);
+        snprintf(buf, sizeof(buf), "Dropped: %llu blocks (~%llu samples)", (unsigned long long)samplePath.ring.overruns.load(), (unsigned long long)st.droppedSamples.load());
+        SmGui::Text(buf);
+        snprintf(buf, sizeof(buf), "Blocked in swap: %.1f ms", st.swapBlockedNs.load() / 1e6);
+        SmGui::Text(buf);
+        snprintf(buf, sizeof(buf), "Jitter p50/p99: %lld/%lld us", (long long)st.jitter.percentile(0.5), (long long)st.jitter.percentile(0.99));
+        SmGui::Text(buf);
+        snprintf(buf, sizeof(buf), "USB to stream p50/p99: %lld/%lld us", (long long)st.latency.percentile(0.5), (long long)st.latency.percentile(0.99));
+        SmGui::Text(buf);
+        snprintf(buf, sizeof(buf), "Discontinuities: %llu", (unsigned long long)st.discontinuities.load());
+        SmGui::Text(buf);
+        snprintf(buf, sizeof(buf), "Level: %.1f dBFS (peak %.1f)", st.levelDbfs.load(), st.peakDbfs.load());
+        SmGui::Text(buf);
+        if (settings.agcEnabled) {
+            snprintf(buf, sizeof(buf), "AGC: gain %d, %llu changes", agc.gain.load(), (unsigned long long)agc.changes.load());
+            SmGui::Text(buf);
+        }
+        if (st.startLatencyUs.load() >= 0) {
+            snprintf(buf, sizeof(buf), "Start to first sample: %.1f ms", st.startLatencyUs.load() / 1000.0);
+            SmGui::Text(buf);
+        }
+        if (st.rateSwitchGapUs.load() >= 0) {
+            snprintf(buf, sizeof(buf), "Rate switch gap: %.1f ms", st.rateSwitchGapUs.load() / 1000.0);
+            SmGui::Text(buf);
+        }
+        snprintf(buf, sizeof(buf), "USB errors: %llu", (unsigned long long)st.usbErrors.load());
+        SmGui::Text(buf);
+        if (st.recoveries.load()) {
+            snprintf(buf, sizeof(buf), "Recoveries: %llu (last outage %.1f ms)", (unsigned long long)st.recoveries.load(), std::max<int64_t>(st.lastOutageUs.load(), 0) / 1000.0);
+            SmGui::Text(buf);
+        }
+        if (running && !dev) {
+            SmGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "Device lost, reopening...");
+        }
+        snprintf(buf, sizeof(buf), "Tune latency last/p99: %lld/%lld us", (long long)st.lastTuneLatencyUs.load(), (long long)st.tuneLatency.percentile(0.99));
+        SmGui::Text(buf);
+        if (settings.iqCorrection) {
+            IQCorrector& c = samplePath.corrector;
+            snprintf(buf, sizeof(buf), "DC: %.4f/%.4f", c.dcOffsetI.load(), c.dcOffsetQ.load());
+            SmGui::Text(buf);
+            snprintf(buf, sizeof(buf), "IQ imbalance: %.2f dB, %.2f deg", c.gainImbalanceDb.load(), c.phaseImbalanceDeg.load());
+            SmGui::Text(buf);
+        }
+    }
+
+    // Upper bound with zero dwell: retune latency plus the discarded block in flight and settling time
+    double maxHopsPerSecond() {
+        double tuneNs = samplePath.stats.averageTuneLatencyNs();
+        double hopNs = tuneNs + (blockLengthUs.load() * 1e3) + (settings.scanSettleMs * 1e6);
+        return (hopNs > 0) ? (1e9 / hopNs) : 0.0;
+    }
+
+    json statsJson() {
+        json j = samplePath.stats.toJson();
+        j["source"] = name;
+        j["device"] = selectedSerial;
+        j["running"] = running;
+        j["deviceOpen"] = (bool)dev;
+        j["sampleRate"] = settings.sampleRate;
+        j["queueDepth"] = samplePath.ring.fill();
+        j["queueCapacity"] = samplePath.ring.depth();
+        j["bufferProfile"] = bufferProfiles[settings.bufferProfile];
+        j["blockLengthUs"] = blockLengthUs.load();
+        j["overrunBlocks"] = samplePath.ring.overruns.load();
+        j["controlCommandsCoalesced"] = controlQueue.coalesced.load();
+        j["scanning"] = settings.scanEnabled;
+        j["scanHops"] = scanner.hops.load();
+        j["scanHopsPerSecond"] = hopsPerSecond.load();
+        j["scanMaxHopsPerSecond"] = maxHopsPerSecond();
+        j["iqCorrection"] = settings.iqCorrection;
+        j["dcOffsetI"] = samplePath.corrector.dcOffsetI.load();
+        j["dcOffsetQ"] = samplePath.corrector.dcOffsetQ.load();
+        j["iqGainImbalanceDb"] = samplePath.corrector.gainImbalanceDb.load();
+        j["iqPhaseImbalanceDeg"] = samplePath.corrector.phaseImbalanceDeg.load();
+        j["overloaded"] = overloaded.load();
+        j["overloadEvents"] = overloadEvents.load();
+        j["agc"] = settings.agcEnabled;
+        j["agcGain"] = agc.gain.load();
+        j["agcChanges"] = agc.changes.load();
+        j["recording"] = recorder.isRecording();
+        j["serverClients"] = server.clientCount();
+        j["serverBytesSent"] = server.bytesSent.load();
+        j["serverClientsDropped"] = server.clientsDropped.load();
+        j["recordedBytes"] = recorder.bytesWritten.load();
+        j["recordDroppedBytes"] = recorder.bytesDropped.load();
+        BlockStamp last = samplePath.lastBlock();
+        j["lastBlock"] = {
+            { "sampleIndex", last.sampleIndex },
+            { "arrivalNs", last.arrivalNs },
+            { "count", last.count },
+            { "decimation", last.decimation },
+            { "hop", last.hop },
+            { "hopFreq", last.hopFreq }
+        };
+        j["recentDiscontinuities"] = json::array();
+        for (const auto& d : samplePath.recentDiscontinuities()) {
+            j["recentDiscontinuities"].push_back({
+                { "kind", discontinuityKinds[d.kind] },
+                { "sampleIndex", d.sampleIndex },
+                { "timeNs", d.timeNs },
+                { "lostSamples", d.lostSamples }
+            });
+        }
+        return j;
+    }
+
+    // Periodic housekeeping: derived rates and the optional JSON stats dump
+    void monitor() {
+        int64_t lastDump = 0;
+        std::unique_lock<std::mutex> lck(monitorMtx);
+        while (!monitorStop) {
+            monitorCnd.wait_for(lck, std::chrono::seconds(1));
+            if (monitorStop) { break; }
+            samplePath.stats.tick();
+            // Settings, running and the device handle only change under settingsMtx. The UI holds
+            // it for a whole frame, the watchdog and the buffering adaptation restart with them.
+            std::unique_lock<std::recursive_mutex> slck(settingsMtx);
+
+            int64_t startUs = samplePath.stats.startLatencyUs.load();
+            if (running && startUs >= 0 && !startLatencyLogged) {
+                startLatencyLogged = true;
+                flog::info("MirisdrSourceModule '{0}': First samples {1} ms after start", name, startUs / 1000.0);
+            }
+            int64_t gapUs = samplePath.stats.rateSwitchGapUs.load();
+            if (running && gapUs >= 0 && !switchLatencyLogged) {
+                switchLatencyLogged = true;
+                flog::info("MirisdrSourceModule '{0}': Sample rate switch left a {1} ms gap", name, gapUs / 1000.0);
+            }
+
+            double clip = samplePath.stats.clipRatio.load();
+            if (!overloaded && clip > settings.clipLogRatio) {
+                overloaded = true;
+                overloadEvents++;
+                flog::warn("MirisdrSourceModule '{0}': ADC overload, {1}% of samples clipped", name, clip * 100.0);
+            }
+            else if (overloaded && clip <= settings.clipLogRatio) {
+                overloaded = false;
+                flog::info("MirisdrSourceModule '{0}': ADC overload cleared", name);
+            }
+
+            if (running) { watchdog(); }
+            int64_t outageUs = samplePath.stats.lastOutageUs.load();
+            if (running && outageUs >= 0 && !outageLogged) {
+                outageLogged = true;
+                flog::info("MirisdrSourceModule '{0}': Stream back after a {1} ms outage", name, outageUs / 1000.0);
+            }
+            if (running && dev && settings.bufferProfile == BUFFER_PROFILE_ADAPTIVE) { adaptBuffering(); }
+
+            uint64_t hops = scanner.hops.load();
+            // The count starts over when a new scan configuration is picked up
+            hopsPerSecond = (double)(hops >= lastHops ? hops - lastHops : hops);
+            lastHops = hops;
+
+            config.acquire();
+            std::string path = config.conf["instances"][name]["statsFile"];
+            int interval = config.conf["instances"][name]["statsInterval"];
+            config.release();
+            int64_t now = telemetryNow();
+            if (path.empty() || now - lastDump < (int64_t)std::max<int>(interval, 1) * 1000000000ll) { continue; }
+            lastDump = now;
+            std::string data = statsJson().dump(4);
+            slck.unlock();
+
+            // Write then rename so scrapers never see a partial file
+            std::string tmp = path + ".tmp";
+            FILE* f = fopen(tmp.c_str(), "w");
+            if (!f) {
+                flog::error("Could not write Mirisdr stats to '{0}'", path);
+                continue;
+            }
+            fwrite(data.c_str(), 1, data.size(), f);
+            fclose(f);
+            rename(tmp.c_str(), path.c_str());
+        }
     }
 
     static void callback(unsigned char *buf, uint32_t len, void *ctx) {
         MirisdrSourceModule* _this = (MirisdrSourceModule*)ctx;
-        int count = (len/sizeof(int16_t)) / 2;
-        int16_t* buffer = (int16_t*)buf;
-        volk_16i_s32f_convert_32f((float*)_this->stream.writeBuf, buffer, 32768.0f, count * 2);
-        if (!_this->stream.swap(count)) { return; }
+        _this->recorder.write(buf, len);
+        _this->server.push((int16_t*)buf, len / sizeof(int16_t));
+        _this->samplePath.push((int16_t*)buf, len / sizeof(int16_t));
     }
 
+    // Shared by all instances
+    inline static std::set<std::string> sourceNames;
+    inline static std::set<std::string> openDevices;
+    inline static std::mutex openDevicesMtx;
+
     std::string name;
-    mirisdr_dev_t* openDev;
+    std::string sourceName;
+    bool selected = false;
+    std::unique_ptr<DeviceBackend> dev;
+    bool keepOpen = false;
+    std::atomic<bool> startLatencyLogged{ false };
+    std::atomic<bool> switchLatencyLogged{ true };
+    // Serializes device access between the control thread and stream restarts
+    std::mutex devMtx;
+    // Serializes start, stop and transfer restarts, which come from the UI, network and monitor threads
+    std::mutex streamMtx;
+    // Guards settings, freq and the selected device against the network and monitor threads.
+    // The UI thread holds it for the whole menu handler since the widgets write the settings in
+    // place. Taken before streamMtx. Recursive because SDR++ may call back into a source handler
+    // while the menu handler unregisters a channel source.
+    std::recursive_mutex settingsMtx;
+
+    // Settings on the open handle, compared against the wanted ones by configureDevice()
+    struct AppliedSettings {
+        bool valid = false;
+        bool hwf;
+        int formatId;
+        int transferId;
+        int sampleRate;
+        int bandwidth;
+        uint32_t freq;
+        bool offsetTuning;
+        int ifFreq;
+        bool autogain;
+        int gain;
+        int mixerGain;
+        int mixbufferGain;
+        int lnaGain;
+        int basebandGain;
+        bool bias;
+    };
+    AppliedSettings applied;
+    // ControlKey bits the control thread has changed on the device since the last configure
+    std::atomic<uint32_t> dirtyKeys{ 0 };
+    ControlQueue controlQueue;
     bool enabled = true;
     std::thread workerThread;
+    std::thread monitorThread;
+    std::mutex monitorMtx;
+    std::condition_variable monitorCnd;
+    bool monitorStop = false;
+    bool showStats = false;
+
+    // Narrowband source published from one channelizer output
+    struct ChannelSource {
+        MirisdrSourceModule* parent;
+        std::string label;
+        std::string sourceName;
+        double offset = 0.0;
+        int outputId = -1;
+        bool running = false;
+        bool selected = false;
+        dsp::stream<dsp::complex_t> stream;
+        SourceManager::SourceHandler handler;
+    };
+    std::vector<std::unique_ptr<ChannelSource>> channels;
+    Channelizer channelizer;
+    bool channelizerEnabled = false;
+    int channelCountId = 3;
+    int newChannelOffsetKHz = 0;
+    // Started channel sources, and whether SDR++ started the source itself
+    int channelUsers = 0;
+    bool mainStarted = false;
+    bool recordRaw = false;
+    RawRecorder recorder;
+    bool serverEnabled = false;
+    int serverPort = 1234;
+    int serverEncodingId = 0;
+    IqServer server;
+    // Network clients are connected
+    bool serverUser = false;
+    // A network client changed the rate, SDR++ is told from the UI thread
+    std::atomic<bool> inputRateStale{ false };
     dsp::stream<dsp::complex_t> stream;
-    int sampleRate;
+    SamplePath samplePath{ &stream };
     SourceManager::SourceHandler handler;
     bool running = false;
     double freq;
     std::string selectedSerial = "";
     int devId = 0;
-    int srId = 0;
-    int bwId = 16;
-    bool devset_autogain = true;
-    int devset_gain = 0;
-    bool devset_hwf = false;
-    int devset_iffreq = 0;
-    bool devset_offsettuning = false;
-    int devset_tuner_gain = 0;
-    int devset_tuner_gain_mode = 0;
-    int devset_mixer_gain = 0;
-    int devset_mixbuffer_gain = 0;
-    int devset_lna_gain = 0;
-    int devset_baseband_gain = 0;
-    bool devset_bias = 0;
+    uint64_t devListGeneration = 0;
+    DeviceSettings settings;
+    ConfigSaver<DeviceSettings> settingsSaver{ commitSettings };
+    ConfigSaver<json> channelSaver{ commitChannels };
+    std::atomic<int> adaptiveStep{ 2 };
+    std::atomic<int> blockLengthUs{ 0 };
+    std::atomic<int> blockSamples{ 0 };
+    uint64_t lastOverruns = 0;
+    int64_t lastSwapBlockedNs = 0;
+    int calmTicks = 0;
+    int64_t nextRecovery = 0;
+    int recoveryBackoffS = 1;
+    std::atomic<bool> outageLogged{ true };
+    int agcGainView = 0;
+    Agc agc;
+    std::atomic<bool> overloaded{ false };
+    std::atomic<uint64_t> overloadEvents{ 0 };
+    int adcBits = 16;
+    Scanner scanner;
+    std::atomic<double> hopsPerSecond{ 0 };
+    uint64_t lastHops = 0;
 
     std::vector<std::string> devList;
     std::string devListTxt;
@@ -606,6 +2319,8 @@ MOD_EXPORT void _INIT_() {
     json def = json({});
     def["devices"] = json({});
     def["device"] = "";
+    def["replayFiles"] = json::array();
+    def["instances"] = json({});
     config.setPath(core::args["root"].s() + "/mirisdr_config.json");
     config.load(def);
     config.enableAutoSave();
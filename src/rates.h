@@ -0,0 +1,85 @@
+#pragma once
+
+constexpr const char* sampleRatesTxt = "15MHz\00014MHz\00013MHz\00012MHz\00011MHz\00010MHz\0009MHz\0008MHz\0007MHz\0006MHz\0005MHz\0004MHz\0003MHz\0002MHz\0001.54MHz\000";
+
+const int sampleRates[] = {
+    15000000,
+    14000000,
+    13000000,
+    12000000,
+    11000000,
+    10000000,
+    9000000,
+    8000000,
+    7000000,
+    6000000,
+    5000000,
+    4000000,
+    3000000,
+    2000000,
+    1540000,
+};
+
+constexpr const char* bufferLengthsTxt = "Auto\0"
+                                         "2.5ms\0"
+                                         "5ms\0"
+                                         "10ms\0"
+                                         "20ms\0"
+                                         "50ms\0";
+
+// Microseconds of IQ per callback block
+const int bufferLengths[] = {
+    0,
+    2500,
+    5000,
+    10000,
+    20000,
+    50000,
+};
+
+enum BufferProfile {
+    BUFFER_PROFILE_MANUAL,
+    BUFFER_PROFILE_LOW_LATENCY,
+    BUFFER_PROFILE_BALANCED,
+    BUFFER_PROFILE_THROUGHPUT,
+    BUFFER_PROFILE_ADAPTIVE
+};
+
+constexpr const char* bufferProfilesTxt = "Manual\0"
+                                          "Low latency\0"
+                                          "Balanced\0"
+                                          "Throughput\0"
+                                          "Adaptive\0";
+
+const char* const bufferProfiles[] = {
+    "manual",
+    "lowLatency",
+    "balanced",
+    "throughput",
+    "adaptive",
+};
+
+struct BufferStep {
+    int lengthUs;
+    int bufferCount;
+    int ringDepth;
+};
+
+// Adaptive buffering moves along these steps, the fixed profiles are points on it.
+// Short blocks need more of them in flight to ride out scheduling hiccups.
+const BufferStep bufferSteps[] = {
+    { 2500, 32, 32 },
+    { 5000, 24, 24 },
+    { 10000, 16, 16 },
+    { 20000, 16, 12 },
+    { 50000, 8, 8 },
+};
+
+// Step of each profile, adaptive starts from balanced
+const int bufferProfileSteps[] = {
+    -1,
+    0,
+    2,
+    4,
+    2,
+};
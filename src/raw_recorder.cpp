@@ -0,0 +1,156 @@
+#include "raw_recorder.h"
+#include <utils/flog.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <filesystem>
+
+#define RAW_RECORDER_ALIGN 4096
+
+RawRecorder::RawRecorder() {}
+
+RawRecorder::~RawRecorder() {
+    stop();
+}
+
+bool RawRecorder::start(std::string path, nlohmann::json header, int bufferSize, int bufferCount) {
+    if (recording) { return false; }
+    this->path = path;
+    this->bufferSize = (bufferSize + RAW_RECORDER_ALIGN - 1) & ~(RAW_RECORDER_ALIGN - 1);
+
+    std::error_code ec;
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    if (!parent.empty()) { std::filesystem::create_directories(parent, ec); }
+
+    // Sidecar header first, a capture without its metadata is useless
+    FILE* hf = fopen((path + ".json").c_str(), "w");
+    if (!hf) {
+        flog::error("Could not write raw capture header for '{0}'", path);
+        return false;
+    }
+    std::string hdr = header.dump(4);
+    fwrite(hdr.c_str(), 1, hdr.size(), hf);
+    fclose(hf);
+
+    direct = true;
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd < 0) {
+        // Some filesystems (tmpfs, some FUSE) refuse O_DIRECT
+        direct = false;
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (fd < 0) {
+        flog::error("Could not open raw capture file '{0}'", path);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lck(mtx);
+    buffers.resize(bufferCount);
+    for (auto& b : buffers) {
+        b.data = (uint8_t*)aligned_alloc(RAW_RECORDER_ALIGN, this->bufferSize);
+        b.used = 0;
+        freeList.push_back(&b);
+    }
+    current = NULL;
+    bytesWritten = 0;
+    bytesDropped = 0;
+    stopRequested = false;
+    workerThread = std::thread(&RawRecorder::worker, this);
+    recording = true;
+    return true;
+}
+
+void RawRecorder::stop() {
+    if (!recording) { return; }
+    {
+        // Cleared under the lock, a callback already past its unlocked check sees it there
+        std::lock_guard<std::mutex> lck(mtx);
+        recording = false;
+        if (current) {
+            fullList.push_back(current);
+            current = NULL;
+        }
+        stopRequested = true;
+    }
+    cnd.notify_all();
+    workerThread.join();
+    close(fd);
+    fd = -1;
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+        freeBuffers();
+    }
+
+    uint64_t dropped = bytesDropped.load();
+    if (dropped) {
+        flog::warn("Raw capture '{0}' dropped {1} bytes, disk too slow", path, dropped);
+    }
+}
+
+void RawRecorder::write(const uint8_t* data, int len) {
+    if (!recording) { return; }
+    std::unique_lock<std::mutex> lck(mtx);
+    if (!recording) { return; }
+    while (len > 0) {
+        if (!current) {
+            if (freeList.empty()) {
+                // Never wait on the disk from the USB thread
+                bytesDropped.fetch_add(len, std::memory_order_relaxed);
+                return;
+            }
+            current = freeList.front();
+            freeList.pop_front();
+            current->used = 0;
+        }
+        int n = std::min<int>(len, bufferSize - current->used);
+        memcpy(&current->data[current->used], data, n);
+        current->used += n;
+        data += n;
+        len -= n;
+        if (current->used == bufferSize) {
+            fullList.push_back(current);
+            current = NULL;
+            cnd.notify_all();
+        }
+    }
+}
+
+void RawRecorder::worker() {
+    std::unique_lock<std::mutex> lck(mtx);
+    while (true) {
+        cnd.wait(lck, [this]() { return !fullList.empty() || stopRequested; });
+        if (fullList.empty()) { break; }
+        Buffer* b = fullList.front();
+        fullList.pop_front();
+        lck.unlock();
+
+        int len = b->used;
+        if (direct && (len % RAW_RECORDER_ALIGN)) {
+            // Only the last buffer can be partial, O_DIRECT needs aligned lengths
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+            direct = false;
+        }
+        int off = 0;
+        while (off < len) {
+            ssize_t ret = ::write(fd, &b->data[off], len - off);
+            if (ret <= 0) {
+                flog::error("Raw capture write to '{0}' failed", path);
+                bytesDropped.fetch_add(len - off, std::memory_order_relaxed);
+                break;
+            }
+            off += ret;
+        }
+        bytesWritten.fetch_add(off, std::memory_order_relaxed);
+
+        lck.lock();
+        freeList.push_back(b);
+    }
+}
+
+void RawRecorder::freeBuffers() {
+    for (auto& b : buffers) { free(b.data); }
+    buffers.clear();
+    freeList.clear();
+    fullList.clear();
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include <json.hpp>
+
+// Writes the device's int16 IQ blocks to disk untouched. The USB callback copies into a
+// pool of preallocated, page aligned buffers; a writer thread flushes full buffers with
+// O_DIRECT so capture never goes through the page cache nor waits on the disk.
+class RawRecorder {
+public:
+    RawRecorder();
+    ~RawRecorder();
+
+    // header is written as <path>.json next to the capture
+    bool start(std::string path, nlohmann::json header, int bufferSize = (4 << 20), int bufferCount = 32);
+    void stop();
+
+    // Called from the USB callback
+    void write(const uint8_t* data, int len);
+
+    bool isRecording() { return recording; }
+
+    std::atomic<uint64_t> bytesWritten{ 0 };
+    std::atomic<uint64_t> bytesDropped{ 0 };
+
+private:
+    struct Buffer {
+        uint8_t* data;
+        int used;
+    };
+
+    void worker();
+    // Caller holds mtx
+    void freeBuffers();
+
+    std::vector<Buffer> buffers;
+    int bufferSize = 0;
+
+    // Buffers the callback may fill, and full buffers waiting for the writer
+    std::deque<Buffer*> freeList;
+    std::deque<Buffer*> fullList;
+    Buffer* current = NULL;
+    std::mutex mtx;
+    std::condition_variable cnd;
+
+    std::thread workerThread;
+    std::atomic<bool> recording{ false };
+    bool stopRequested = false;
+    int fd = -1;
+    bool direct = false;
+    std::string path;
+};
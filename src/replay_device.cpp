@@ -0,0 +1,84 @@
+#include "replay_device.h"
+#include <utils/flog.h>
+#include <chrono>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+ReplayDevice::ReplayDevice(std::string path, bool realtime) {
+    this->path = path;
+    this->realtime = realtime;
+}
+
+ReplayDevice::~ReplayDevice() {
+    if (fd >= 0) { close(); }
+}
+
+int ReplayDevice::open() {
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        flog::error("Could not open replay file '{0}'", path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < 4) {
+        flog::error("Replay file '{0}' is empty", path);
+        ::close(fd);
+        fd = -1;
+        return -1;
+    }
+    size = st.st_size & ~(size_t)3;
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        flog::error("Could not map replay file '{0}'", path);
+        ::close(fd);
+        fd = -1;
+        return -1;
+    }
+    data = (unsigned char*)map;
+    madvise(data, size, MADV_SEQUENTIAL);
+    offset = 0;
+    cancelled = false;
+    return 0;
+}
+
+int ReplayDevice::close() {
+    if (data) { munmap(data, size); }
+    if (fd >= 0) { ::close(fd); }
+    data = NULL;
+    fd = -1;
+    return 0;
+}
+
+int ReplayDevice::readAsync(DeviceReadCallback cb, void* ctx, uint32_t, uint32_t bufLen) {
+    if (!data || bufLen == 0 || bufLen > size) { return -1; }
+
+    // Pace against an absolute schedule so sleep jitter doesn't accumulate
+    auto blockTime = std::chrono::nanoseconds(sampleRate ? ((int64_t)bufLen / 4) * 1000000000ll / sampleRate : 0);
+    auto deadline = std::chrono::steady_clock::now();
+
+    while (!cancelled) {
+        // The capture loops, a partial block at the end of the file is skipped
+        if (offset + bufLen > size) { offset = 0; }
+        cb(data + offset, bufLen, ctx);
+        offset += bufLen;
+
+        if (!realtime) { continue; }
+        deadline += blockTime;
+        auto now = std::chrono::steady_clock::now();
+        if (now - deadline > std::chrono::seconds(1)) {
+            // Too far behind to catch up, restart the schedule instead of bursting
+            deadline = now;
+            continue;
+        }
+        std::this_thread::sleep_until(deadline);
+    }
+    return 0;
+}
+
+int ReplayDevice::cancelAsync() {
+    cancelled = true;
+    return 0;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "device.h"
+#include <atomic>
+#include <string>
+
+// Replays a raw interleaved int16 IQ capture through the device backend interface,
+// either paced at the configured sample rate or as fast as the consumer allows.
+class ReplayDevice : public DeviceBackend {
+public:
+    ReplayDevice(std::string path, bool realtime);
+    ~ReplayDevice();
+
+    int open();
+    int close();
+
+    int setHwFlavour(bool) { return 0; }
+    int setSampleFormat(const char*) { return 0; }
+    int setTransfer(const char*) { return 0; }
+    int setSampleRate(uint32_t rate) {
+        sampleRate = rate;
+        return 0;
+    }
+    int setBandwidth(uint32_t) { return 0; }
+    int setCenterFreq(uint32_t freq) {
+        centerFreq = freq;
+        return 0;
+    }
+    uint32_t getCenterFreq() { return centerFreq; }
+    int setOffsetTuning(bool) { return 0; }
+    int setIfFreq(uint32_t) { return 0; }
+    int setTunerGain(int) { return 0; }
+    int setMixerGain(int) { return 0; }
+    int setMixbufferGain(int) { return 0; }
+    int setLnaGain(int) { return 0; }
+    int setBasebandGain(int) { return 0; }
+    int setBias(bool) { return 0; }
+    // Called on the control thread before every readAsync(), a cancel can't be lost to a
+    // reader that starts late
+    int resetBuffer() {
+        offset = 0;
+        cancelled = false;
+        return 0;
+    }
+
+    int readAsync(DeviceReadCallback cb, void* ctx, uint32_t bufNum, uint32_t bufLen);
+    int cancelAsync();
+
+private:
+    std::string path;
+    bool realtime;
+    int fd = -1;
+    unsigned char* data = NULL;
+    size_t size = 0;
+    size_t offset = 0;
+    uint32_t sampleRate = 0;
+    uint32_t centerFreq = 0;
+    std::atomic<bool> cancelled{ false };
+};
@@ -0,0 +1,161 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <sys/mman.h>
+#include <vector>
+
+#define RING_CACHE_LINE 64
+
+// Single producer / single consumer ring of fixed size sample blocks.
+// The producer side (USB callback) never blocks and never allocates: when all slots
+// are in use the block is dropped and accounted as an overrun instead.
+template <class T>
+class SampleRing {
+public:
+    struct alignas(RING_CACHE_LINE) Slot {
+        T* data;
+        int count;
+        // Caller defined position of the block in the sample stream
+        uint64_t sampleIndex;
+        // Blocks dropped between the previous slot and this one
+        uint32_t dropsBefore;
+        // Caller defined arrival time of the block
+        int64_t timestamp;
+    };
+
+    SampleRing() {}
+
+    ~SampleRing() {
+        free();
+    }
+
+    SampleRing(const SampleRing&) = delete;
+    SampleRing& operator=(const SampleRing&) = delete;
+
+    void init(int depth, int capacity) {
+        free();
+        _depth = depth;
+        _capacity = capacity;
+
+        // Round every slot up to a whole number of cache lines so slots never share one
+        size_t slotBytes = ((capacity * sizeof(T)) + RING_CACHE_LINE - 1) & ~(size_t)(RING_CACHE_LINE - 1);
+        storageBytes = slotBytes * depth;
+        storage = (uint8_t*)aligned_alloc(RING_CACHE_LINE, storageBytes);
+        slots.resize(depth);
+        for (int i = 0; i < depth; i++) {
+            slots[i].data = (T*)(storage + (slotBytes * i));
+            slots[i].count = 0;
+            slots[i].sampleIndex = 0;
+            slots[i].dropsBefore = 0;
+            slots[i].timestamp = 0;
+        }
+        reset();
+    }
+
+    void free() {
+        if (locked) { munlock(storage, storageBytes); }
+        locked = false;
+        if (storage) { ::free(storage); }
+        storage = NULL;
+        storageBytes = 0;
+        slots.clear();
+        _depth = 0;
+        _capacity = 0;
+    }
+
+    // Pins the slots in RAM until the next init() or free(), fails past RLIMIT_MEMLOCK
+    bool lock() {
+        if (!storage) { return false; }
+        if (!locked) { locked = !mlock(storage, storageBytes); }
+        return locked;
+    }
+
+    void reset() {
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+        pendingDrops = 0;
+        overruns.store(0, std::memory_order_relaxed);
+    }
+
+    // Producer side
+
+    T* beginWrite() {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= (uint64_t)_depth) {
+            pendingDrops++;
+            overruns.fetch_add(1, std::memory_order_relaxed);
+            return NULL;
+        }
+        return slots[h % _depth].data;
+    }
+
+    void commitWrite(int count, uint64_t sampleIndex = 0, int64_t timestamp = 0) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        Slot& s = slots[h % _depth];
+        s.count = count;
+        s.sampleIndex = sampleIndex;
+        s.timestamp = timestamp;
+        s.dropsBefore = pendingDrops;
+        pendingDrops = 0;
+        head.store(h + 1, std::memory_order_release);
+        // Notifying without the lock keeps the producer wait-free, a missed wakeup is
+        // caught by the consumer's wait timeout
+        cnd.notify_one();
+    }
+
+    // Consumer side
+
+    Slot* beginRead() {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        while (head.load(std::memory_order_acquire) == t) {
+            std::unique_lock<std::mutex> lck(mtx);
+            if (stopped) { return NULL; }
+            cnd.wait_for(lck, std::chrono::milliseconds(5));
+        }
+        return &slots[t % _depth];
+    }
+
+    void endRead() {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    void stopReader() {
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            stopped = true;
+        }
+        cnd.notify_all();
+    }
+
+    void clearReadStop() {
+        std::lock_guard<std::mutex> lck(mtx);
+        stopped = false;
+    }
+
+    int depth() { return _depth; }
+    int capacity() { return _capacity; }
+    int fill() { return (int)(head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire)); }
+
+    std::atomic<uint64_t> overruns{0};
+
+private:
+    alignas(RING_CACHE_LINE) std::atomic<uint64_t> head{0};
+    alignas(RING_CACHE_LINE) std::atomic<uint64_t> tail{0};
+    alignas(RING_CACHE_LINE) uint32_t pendingDrops = 0;
+
+    std::vector<Slot> slots;
+    uint8_t* storage = NULL;
+    size_t storageBytes = 0;
+    bool locked = false;
+    int _depth = 0;
+    int _capacity = 0;
+
+    std::mutex mtx;
+    std::condition_variable cnd;
+    bool stopped = false;
+};
@@ -0,0 +1,289 @@
+#include "sample_path.h"
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+SamplePath::SamplePath(dsp::stream<dsp::complex_t>* out) {
+    this->out = out;
+    convert = selectConvertKernel(16, false, false);
+    measure = selectLevelKernel(16);
+}
+
+void SamplePath::start(int ringDepth, int blockLen, int sampleRate, int64_t startTime) {
+    if (running) { return; }
+    stats.reset();
+    sampleCounter = 0;
+    firstBlockStat = &stats.startLatencyUs;
+    launch(ringDepth, blockLen, sampleRate, startTime);
+}
+
+void SamplePath::restart(int ringDepth, int blockLen, int sampleRate, int64_t startTime) {
+    if (running) { return; }
+    stats.rateSwitches.fetch_add(1, std::memory_order_relaxed);
+    firstBlockStat = &stats.rateSwitchGapUs;
+    launch(ringDepth, blockLen, sampleRate, startTime);
+}
+
+void SamplePath::recover(int ringDepth, int blockLen, int sampleRate) {
+    if (running) { return; }
+    stats.recoveries.fetch_add(1, std::memory_order_relaxed);
+    int64_t last = lastArrival.load();
+    outageStart = last ? last : launchTime.load();
+    stats.lastOutageUs = -1;
+    firstBlockStat = &stats.lastOutageUs;
+    launch(ringDepth, blockLen, sampleRate, outageStart);
+}
+
+int64_t SamplePath::lastActivity() {
+    return std::max<int64_t>(lastArrival.load(std::memory_order_relaxed), launchTime.load(std::memory_order_relaxed));
+}
+
+void SamplePath::launch(int ringDepth, int blockLen, int sampleRate, int64_t startTime) {
+    ring.init(ringDepth, blockLen);
+    if (lockMemory && !ring.lock()) {
+        flog::warn("Could not lock the sample ring in memory ({0}), it may be paged out", strerror(errno));
+    }
+    blockPeriodNs = ((int64_t)(blockLen / 2) * 1000000000ll) / sampleRate;
+    this->startTime = startTime ? startTime : telemetryNow();
+    this->sampleRate = sampleRate;
+    firstBlock = true;
+    lastArrival = 0;
+    launchTime = telemetryNow();
+    decim.init(decimation, SAMPLE_PATH_CHUNK);
+    corrector.init(sampleRate);
+    scratch.resize(SAMPLE_PATH_CHUNK);
+    workerThread = std::thread(&SamplePath::worker, this);
+    running = true;
+}
+
+void SamplePath::stop() {
+    if (!running) { return; }
+    ring.stopReader();
+    out->stopWriter();
+    workerThread.join();
+    out->clearWriteStop();
+    ring.clearReadStop();
+    running = false;
+}
+
+void SamplePath::setKernel(ConvertKernel kernel) {
+    convert.store(kernel);
+}
+
+void SamplePath::setLevelKernel(LevelKernel kernel) {
+    measure.store(kernel);
+}
+
+void SamplePath::setDecimation(int factor) {
+    decimation = factor;
+}
+
+void SamplePath::setCorrection(bool enabled) {
+    correction.store(enabled);
+}
+
+void SamplePath::setAgc(Agc* agc) {
+    this->agc.store(agc);
+}
+
+void SamplePath::setScanner(Scanner* scanner) {
+    this->scanner.store(scanner);
+}
+
+void SamplePath::setChannelizer(Channelizer* channelizer) {
+    this->channelizer.store(channelizer);
+}
+
+void SamplePath::setPublish(bool enabled) {
+    if (enabled) {
+        out->clearWriteStop();
+        publish = true;
+        return;
+    }
+    // Unblocks a swap waiting on a reader that is going away
+    publish = false;
+    out->stopWriter();
+}
+
+void SamplePath::setThreadPolicy(const ThreadPolicy& policy) {
+    threadPolicy = policy;
+}
+
+void SamplePath::setLockMemory(bool lock) {
+    lockMemory = lock;
+}
+
+// Computed in double, nanoseconds times the sample rate overflows int64 after about ten minutes at 15 MS/s
+uint64_t SamplePath::nsToSamples(int64_t ns) {
+    return (uint64_t)((double)ns * sampleRate / 1e9);
+}
+
+void SamplePath::push(const int16_t* buf, int count) {
+    int64_t now = stats.onCallback(blockPeriodNs);
+    if (firstBlock) {
+        firstBlockStat->store((now - startTime) / 1000, std::memory_order_relaxed);
+        firstBlock = false;
+        if (outageStart) {
+            uint64_t lost = nsToSamples(now - outageStart);
+            stats.outageSamples.fetch_add(lost, std::memory_order_relaxed);
+            markDiscontinuity(DISC_STALL, sampleCounter.load(std::memory_order_relaxed), lost);
+            outageStart = 0;
+        }
+    }
+    uint64_t index = sampleCounter.fetch_add(count / 2, std::memory_order_relaxed);
+
+    // Transfers complete in bursts, only a gap far beyond that means samples never arrived
+    int64_t last = lastArrival.load(std::memory_order_relaxed);
+    int64_t gap = last ? (now - last) : 0;
+    lastArrival.store(now, std::memory_order_relaxed);
+    if (gap > blockPeriodNs * SAMPLE_PATH_STALL_BLOCKS) {
+        markDiscontinuity(DISC_STALL, index, nsToSamples(gap - blockPeriodNs));
+    }
+
+    // Only copy into the ring here, anything slower would stall the USB transfers. A block
+    // longer than a slot is split, a part that finds no free slot is an overrun like a
+    // whole block.
+    int slotLen = ring.capacity() & ~1;
+    for (int done = 0; done < count; done += slotLen) {
+        int16_t* slot = ring.beginWrite();
+        if (!slot) { continue; }
+        int n = std::min<int>(count - done, slotLen);
+        memcpy(slot, &buf[done], n * sizeof(int16_t));
+        ring.commitWrite(n, index + (done / 2), now);
+    }
+
+    int fill = ring.fill();
+    if (fill > stats.peakQueueDepth.load(std::memory_order_relaxed)) {
+        stats.peakQueueDepth.store(fill, std::memory_order_relaxed);
+    }
+}
+
+void SamplePath::markDiscontinuity(DiscontinuityKind kind, uint64_t sampleIndex, uint64_t lostSamples) {
+    stats.discontinuities.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lck(discontinuityMtx);
+    discontinuityLog.push_back({ kind, sampleIndex, telemetryNow(), lostSamples });
+    if (discontinuityLog.size() > SAMPLE_PATH_DISCONTINUITY_LOG) { discontinuityLog.pop_front(); }
+}
+
+std::vector<Discontinuity> SamplePath::recentDiscontinuities() {
+    std::lock_guard<std::mutex> lck(discontinuityMtx);
+    return std::vector<Discontinuity>(discontinuityLog.begin(), discontinuityLog.end());
+}
+
+BlockStamp SamplePath::lastBlock() {
+    std::lock_guard<std::mutex> lck(stampMtx);
+    return stamp;
+}
+
+void SamplePath::worker() {
+    applyThreadPolicy(threadPolicy, "publisher");
+    // The counter advances for dropped blocks too, so a jump in it is exactly what was lost
+    uint64_t nextIndex = sampleCounter.load();
+    while (true) {
+        SampleRing<int16_t>::Slot* slot = ring.beginRead();
+        if (!slot) { return; }
+        int count = slot->count / 2;
+        uint64_t index = slot->sampleIndex;
+        int64_t arrival = slot->timestamp;
+        if (index > nextIndex) {
+            stats.droppedSamples.fetch_add(index - nextIndex, std::memory_order_relaxed);
+            markDiscontinuity(DISC_OVERRUN, nextIndex, index - nextIndex);
+        }
+        nextIndex = index + count;
+        if (cs16.rawSubscribers()) { cs16.publish(slot->data, slot->count / 2, slot->sampleIndex, slot->timestamp, sampleRate); }
+
+        // While scanning only the settled samples of the current hop are published
+        const int16_t* data = slot->data;
+        Scanner* sc = scanner.load(std::memory_order_relaxed);
+        HopTag tag{};
+        if (sc) {
+            int first, n;
+            if (!sc->filter(slot->sampleIndex, count, first, n, tag)) {
+                ring.endRead();
+                continue;
+            }
+            data += first * 2;
+            index += first;
+            count = n;
+            if (cs16.hopSubscribers()) { cs16.publishHop(data, tag, arrival, sampleRate); }
+            // Filter history from the previous frequency must not leak into the new hop
+            if (tag.hopStart) { decim.reset(); }
+        }
+
+        Channelizer* ch = channelizer.load(std::memory_order_relaxed);
+        bool publishing = publish.load(std::memory_order_relaxed);
+        if (!publishing && !ch) {
+            // Only int16 subscribers, the level still feeds the statistics and the AGC
+            BlockLevel level;
+            measure.load(std::memory_order_relaxed)(data, count, &level);
+            ring.endRead();
+            converting = false;
+            if (count) {
+                stats.onLevel(level.power, level.peak, level.clipped, count);
+                Agc* a = agc.load(std::memory_order_relaxed);
+                if (a) { a->onLevel(level.power, level.peak, count, telemetryNow()); }
+            }
+            continue;
+        }
+        if (!converting) {
+            // Filter history from before the pause doesn't belong to these samples
+            decim.reset();
+            converting = true;
+        }
+
+        ConvertKernel kernel = convert.load(std::memory_order_relaxed);
+        bool correct = correction.load(std::memory_order_relaxed);
+        if (correct != correcting) {
+            // Start from fresh estimates, old ones may predate a retune or gain change
+            corrector.reset();
+            correcting = correct;
+        }
+        BlockLevel level;
+        int converted = count;
+        if (decim.enabled() || correct) {
+            // Convert, correct and decimate chunk by chunk so the float samples never leave the cache
+            int produced = 0;
+            for (int i = 0; i < count; i += SAMPLE_PATH_CHUNK) {
+                int n = std::min<int>(SAMPLE_PATH_CHUNK, count - i);
+                dsp::complex_t* chunk = decim.enabled() ? scratch.data() : &out->writeBuf[i];
+                kernel(&data[i * 2], chunk, n, &level);
+                if (correct) { corrector.process(chunk, n); }
+                produced += decim.enabled() ? decim.process(chunk, n, &out->writeBuf[produced]) : n;
+            }
+            count = produced;
+        }
+        else {
+            kernel(data, out->writeBuf, count, &level);
+        }
+        ring.endRead();
+
+        if (converted) {
+            stats.onLevel(level.power, level.peak, level.clipped, converted);
+            Agc* a = agc.load(std::memory_order_relaxed);
+            if (a) { a->onLevel(level.power, level.peak, converted, telemetryNow()); }
+        }
+
+        if (!count) { continue; }
+        if (ch) { ch->process(out->writeBuf, count); }
+        if (!publishing) { continue; }
+        int64_t t0 = telemetryNow();
+        if (!out->swap(count)) {
+            // Publishing was turned off while waiting, the channels keep going
+            if (!publish.load()) { continue; }
+            return;
+        }
+        int64_t t1 = telemetryNow();
+        stats.swapBlockedNs.fetch_add(t1 - t0, std::memory_order_relaxed);
+        stats.latency.add((t1 - arrival) / 1000);
+        stats.samplesDelivered.fetch_add(count, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lck(stampMtx);
+            stamp.sampleIndex = index;
+            stamp.arrivalNs = arrival;
+            stamp.count = count;
+            stamp.decimation = decimation;
+            stamp.hop = sc ? (int64_t)tag.hop : -1;
+            stamp.hopFreq = sc ? tag.freq : 0;
+        }
+    }
+}
@@ -0,0 +1,155 @@
+#pragma once
+#include <dsp/stream.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ring_buffer.h"
+#include "convert.h"
+#include "telemetry.h"
+#include "decimator.h"
+#include "scanner.h"
+#include "iq_correction.h"
+#include "agc.h"
+#include "thread_policy.h"
+#include "channelizer.h"
+#include "cs16_stream.h"
+
+// Samples converted per pass when decimating, small enough for the chunk to stay in L1/L2
+#define SAMPLE_PATH_CHUNK 4096
+// Discontinuities kept for inspection
+#define SAMPLE_PATH_DISCONTINUITY_LOG 64
+// Callback gap, in block periods, beyond which the device is considered to have stalled
+#define SAMPLE_PATH_STALL_BLOCKS 8
+
+enum DiscontinuityKind {
+    DISC_OVERRUN,       // Blocks dropped because the ring was full
+    DISC_STALL,         // The device stopped delivering for longer than its queued transfers explain
+    DISC_RETUNE,
+    DISC_RATE_CHANGE,
+    DISC_RESTART        // Transfer restarted at the same rate, e.g. to resize the buffers
+};
+
+// Break in the sample stream. sampleIndex counts device rate samples since start().
+struct Discontinuity {
+    DiscontinuityKind kind;
+    uint64_t sampleIndex;
+    int64_t timeNs;
+    uint64_t lostSamples;
+};
+
+// Timing of the last published block: its first sample's index in the device sample counter,
+// and when the USB transfer holding it completed. While scanning it also carries the hop the
+// block belongs to, hop is -1 otherwise.
+struct BlockStamp {
+    uint64_t sampleIndex = 0;
+    int64_t arrivalNs = 0;
+    int count = 0;
+    int decimation = 1;
+    int64_t hop = -1;
+    uint32_t hopFreq = 0;
+};
+
+// Everything between the device callback and the output stream: the callback pushes raw
+// int16 blocks into the ring, a publisher thread converts them and swaps them into the stream.
+// The raw blocks are also copied out to int16 subscribers. Without a float
+// consumer (published stream or channelizer) nothing is converted, only the level is measured.
+class SamplePath {
+public:
+    SamplePath(dsp::stream<dsp::complex_t>* out);
+
+    // startTime is when the caller began starting the device, for the start latency
+    void start(int ringDepth, int blockLen, int sampleRate, int64_t startTime = 0);
+    void stop();
+
+    // Starts again after stop() with a new block size and rate, keeping the statistics and the
+    // sample counter. The time from startTime to the first new block is the switch gap.
+    void restart(int ringDepth, int blockLen, int sampleRate, int64_t startTime);
+
+    // Starts again after a stall on a reopened device. The outage since the last block before
+    // the stall is accounted when the first new block arrives.
+    void recover(int ringDepth, int blockLen, int sampleRate);
+
+    // Time of the last device block, or of the last (re)start if none arrived since
+    int64_t lastActivity();
+
+    void setKernel(ConvertKernel kernel);
+    // Measures blocks that aren't converted, must match the kernel's resolution
+    void setLevelKernel(LevelKernel kernel);
+
+    // Power of two, takes effect on the next start()
+    void setDecimation(int factor);
+
+    // DC and IQ imbalance correction, can be toggled while running
+    void setCorrection(bool enabled);
+
+    // Feeds the block levels to an AGC, NULL disables it
+    void setAgc(Agc* agc);
+
+    // Enables hop gating, NULL returns to continuous streaming
+    void setScanner(Scanner* scanner);
+
+    // Feeds every published block to a channelizer, NULL disables it
+    void setChannelizer(Channelizer* channelizer);
+
+    // Whether blocks go to the output stream. Without it they are still converted for the
+    // channelizer, the stream is left alone so nothing needs to read it.
+    void setPublish(bool enabled);
+
+    // Scheduling of the publisher thread and locking of the ring, take effect on the next start()
+    void setThreadPolicy(const ThreadPolicy& policy);
+    void setLockMemory(bool lock);
+
+    // Producer side, called from the USB callback. count is in int16 values.
+    void push(const int16_t* buf, int count);
+
+    // Records a break at the given sample index, for the events the sample path can't see
+    void markDiscontinuity(DiscontinuityKind kind, uint64_t sampleIndex, uint64_t lostSamples = 0);
+    std::vector<Discontinuity> recentDiscontinuities();
+    BlockStamp lastBlock();
+
+    SampleRing<int16_t> ring;
+    Cs16Stream cs16;
+    Telemetry stats;
+    IQCorrector corrector;
+
+    // Complex samples received from the device, including dropped blocks
+    std::atomic<uint64_t> sampleCounter{ 0 };
+
+private:
+    void worker();
+    void launch(int ringDepth, int blockLen, int sampleRate, int64_t startTime);
+    uint64_t nsToSamples(int64_t ns);
+
+    dsp::stream<dsp::complex_t>* out;
+    std::atomic<ConvertKernel> convert;
+    std::atomic<LevelKernel> measure;
+    std::atomic<Scanner*> scanner{ NULL };
+    std::atomic<bool> correction{ false };
+    std::atomic<Agc*> agc{ NULL };
+    std::atomic<Channelizer*> channelizer{ NULL };
+    std::atomic<bool> publish{ true };
+    int decimation = 1;
+    Decimator decim;
+    bool correcting = false;
+    bool converting = true;
+    std::vector<dsp::complex_t> scratch;
+    std::thread workerThread;
+    ThreadPolicy threadPolicy;
+    bool lockMemory = false;
+    bool running = false;
+    int64_t blockPeriodNs = 0;
+    int64_t startTime = 0;
+    bool firstBlock = false;
+    std::atomic<int64_t> lastArrival{ 0 };
+    std::atomic<int64_t> launchTime{ 0 };
+    int64_t sampleRate = 0;
+    int64_t outageStart = 0;
+
+    std::deque<Discontinuity> discontinuityLog;
+    std::mutex discontinuityMtx;
+    BlockStamp stamp;
+    std::mutex stampMtx;
+    std::atomic<int64_t>* firstBlockStat = NULL;
+};
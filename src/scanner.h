@@ -0,0 +1,138 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+// Metadata for a block of samples published while scanning. All samples of a block belong
+// to the same hop, firstSample is the index in the device sample counter.
+struct HopTag {
+    uint64_t hop;
+    uint32_t freq;
+    uint64_t firstSample;
+    int count;
+    bool hopStart;
+};
+
+// Frequency hopping state machine driven from the publisher thread. Settling is tracked by
+// device sample counter: the retune completion records the counter, every sample before
+// counter + settle is discarded and the following dwell samples are published.
+// filter() runs on the publisher thread, configure() may come from any thread: the new list is
+// staged and only picked up by the next filter(), which restarts from the first frequency.
+class Scanner {
+public:
+    void configure(std::vector<uint32_t> freqs, int64_t dwellSamples, int64_t settleSamples) {
+        {
+            std::lock_guard<std::mutex> lck(pendingMtx);
+            pending.freqs = freqs;
+            pending.dwellSamples = std::max<int64_t>(dwellSamples, 1);
+            pending.settleSamples = settleSamples;
+        }
+        restart.store(true, std::memory_order_release);
+    }
+
+    // Set once before the first filter(). Called from the publisher thread, the implementation
+    // must pass seq back to onTuned() once the device reports the new frequency, or to
+    // onTuneFailed() if it couldn't be tuned.
+    std::function<void(uint32_t freq, uint64_t seq)> retune;
+
+    // Called from the control thread with the device sample counter at retune completion.
+    // guardSamples covers what was already captured at the old frequency but not yet counted,
+    // the USB block in flight. Completions of an older retune are ignored.
+    void onTuned(uint64_t seq, uint64_t sampleCounter, int64_t guardSamples) {
+        if (seq != tuneSeq.load(std::memory_order_acquire)) { return; }
+        settleEnd.store(sampleCounter + guardSamples + settle.load(std::memory_order_relaxed), std::memory_order_release);
+    }
+
+    // Called from the control thread when the retune failed, the hop is skipped
+    void onTuneFailed(uint64_t seq) {
+        if (seq != tuneSeq.load(std::memory_order_acquire)) { return; }
+        tuneFailed.store(true, std::memory_order_release);
+    }
+
+    // Narrows [index, index + count) to the samples that should be published. Returns false
+    // when the whole block must be discarded.
+    bool filter(uint64_t index, int count, int& first, int& n, HopTag& tag) {
+        if (restart.exchange(false, std::memory_order_acq_rel)) {
+            std::lock_guard<std::mutex> lck(pendingMtx);
+            active = pending;
+            settle.store(active.settleSamples, std::memory_order_relaxed);
+            hopIndex = -1;
+            hops = 0;
+        }
+        const std::vector<uint32_t>& freqs = active.freqs;
+        if (freqs.empty()) { return false; }
+        if (hopIndex < 0) {
+            nextHop();
+            return false;
+        }
+
+        if (tuneFailed.exchange(false, std::memory_order_acq_rel)) {
+            nextHop();
+            return false;
+        }
+        uint64_t start = settleEnd.load(std::memory_order_acquire);
+        if (start == UINT64_MAX) { return false; }
+        if (waiting) {
+            waiting = false;
+            dwellEnd = start + active.dwellSamples;
+            published = 0;
+        }
+
+        uint64_t end = index + count;
+        uint64_t from = std::max<uint64_t>(index, start);
+        uint64_t to = std::min<uint64_t>(end, dwellEnd);
+        bool hasData = (from < to);
+        if (hasData) {
+            first = (int)(from - index);
+            n = (int)(to - from);
+            tag.hop = hops.load(std::memory_order_relaxed);
+            tag.freq = freqs[hopIndex];
+            tag.firstSample = from;
+            tag.count = n;
+            tag.hopStart = (published == 0);
+            published += n;
+        }
+        if (end >= dwellEnd) {
+            hops.fetch_add(1, std::memory_order_relaxed);
+            nextHop();
+        }
+        return hasData;
+    }
+
+    std::atomic<uint64_t> hops{ 0 };
+
+private:
+    void nextHop() {
+        hopIndex = (hopIndex + 1) % active.freqs.size();
+        // A new sequence number first, so a late completion of the previous retune can't settle this hop
+        uint64_t seq = tuneSeq.fetch_add(1, std::memory_order_acq_rel) + 1;
+        settleEnd.store(UINT64_MAX, std::memory_order_release);
+        tuneFailed.store(false, std::memory_order_release);
+        waiting = true;
+        retune(active.freqs[hopIndex], seq);
+    }
+
+    struct Config {
+        std::vector<uint32_t> freqs;
+        int64_t dwellSamples = 1;
+        int64_t settleSamples = 0;
+    };
+
+    std::mutex pendingMtx;
+    Config pending;
+    std::atomic<bool> restart{ false };
+
+    // Publisher thread only
+    Config active;
+    int hopIndex = -1;
+    bool waiting = false;
+    uint64_t dwellEnd = 0;
+    uint64_t published = 0;
+    std::atomic<uint64_t> settleEnd{ UINT64_MAX };
+    std::atomic<bool> tuneFailed{ false };
+    std::atomic<uint64_t> tuneSeq{ 0 };
+    std::atomic<int64_t> settle{ 0 };
+};
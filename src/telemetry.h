@@ -0,0 +1,221 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <stdint.h>
+#include <json.hpp>
+
+#define TELEMETRY_HIST_BUCKETS 24
+
+// steady_clock is CLOCK_MONOTONIC on Linux, so these times can be compared with other processes
+inline int64_t telemetryNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Power of two histogram of microsecond values, bucket i holds [2^(i-1), 2^i) us
+class Histogram {
+public:
+    void add(int64_t us) {
+        int b = 0;
+        while (us > 0 && b < TELEMETRY_HIST_BUCKETS - 1) {
+            us >>= 1;
+            b++;
+        }
+        buckets[b].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Upper bound in microseconds of the bucket holding the given percentile
+    int64_t percentile(double p) {
+        uint64_t counts[TELEMETRY_HIST_BUCKETS];
+        uint64_t total = 0;
+        for (int i = 0; i < TELEMETRY_HIST_BUCKETS; i++) {
+            counts[i] = buckets[i].load(std::memory_order_relaxed);
+            total += counts[i];
+        }
+        if (!total) { return 0; }
+        uint64_t target = (uint64_t)(p * total);
+        uint64_t acc = 0;
+        for (int i = 0; i < TELEMETRY_HIST_BUCKETS; i++) {
+            acc += counts[i];
+            if (acc > target) { return 1ll << i; }
+        }
+        return 1ll << (TELEMETRY_HIST_BUCKETS - 1);
+    }
+
+    void reset() {
+        for (auto& b : buckets) { b.store(0, std::memory_order_relaxed); }
+    }
+
+    nlohmann::json toJson() {
+        nlohmann::json j = nlohmann::json::array();
+        for (auto& b : buckets) { j.push_back(b.load(std::memory_order_relaxed)); }
+        return j;
+    }
+
+private:
+    std::atomic<uint64_t> buckets[TELEMETRY_HIST_BUCKETS] = {};
+};
+
+// Always-on counters for the read path. Writers only do relaxed atomic adds.
+class Telemetry {
+public:
+    // Called from the USB callback for every block, returns the arrival time
+    int64_t onCallback(int64_t blockPeriodNs) {
+        int64_t now = telemetryNow();
+        callbacks.fetch_add(1, std::memory_order_relaxed);
+        if (lastCallback) {
+            int64_t dev = (now - lastCallback) - blockPeriodNs;
+            jitter.add((dev < 0 ? -dev : dev) / 1000);
+        }
+        lastCallback = now;
+        return now;
+    }
+
+    // Called from the control thread once a retune has been applied
+    void onTune(int64_t latencyNs) {
+        lastTuneLatencyUs.store(latencyNs / 1000, std::memory_order_relaxed);
+        tunes.fetch_add(1, std::memory_order_relaxed);
+        tuneLatencySumNs.fetch_add(latencyNs, std::memory_order_relaxed);
+        tuneLatency.add(latencyNs / 1000);
+    }
+
+    // Called from the publisher with the level of every converted block
+    void onLevel(float power, float peak, int clipped, int count) {
+        levelDbfs.store(10.0f * log10f((power / count) + 1e-12f), std::memory_order_relaxed);
+        peakDbfs.store(20.0f * log10f(peak + 1e-12f), std::memory_order_relaxed);
+        clippedValues.fetch_add(clipped, std::memory_order_relaxed);
+        convertedValues.fetch_add((uint64_t)count * 2, std::memory_order_relaxed);
+    }
+
+    double averageTuneLatencyNs() {
+        uint64_t n = tunes.load(std::memory_order_relaxed);
+        return n ? (double)tuneLatencySumNs.load(std::memory_order_relaxed) / (double)n : 0.0;
+    }
+
+    // Called periodically to derive the delivered sample rate and the clipping ratio
+    void tick() {
+        if (tickReset.exchange(false, std::memory_order_acquire)) {
+            lastTick = 0;
+            lastDelivered = 0;
+            lastClipped = 0;
+            lastConverted = 0;
+        }
+        int64_t now = telemetryNow();
+        uint64_t delivered = samplesDelivered.load(std::memory_order_relaxed);
+        if (lastTick && now > lastTick) {
+            samplesPerSecond = (double)(delivered - lastDelivered) * 1e9 / (double)(now - lastTick);
+        }
+        lastTick = now;
+        lastDelivered = delivered;
+
+        uint64_t clipped = clippedValues.load(std::memory_order_relaxed);
+        uint64_t converted = convertedValues.load(std::memory_order_relaxed);
+        clipRatio = (converted > lastConverted) ? (double)(clipped - lastClipped) / (double)(converted - lastConverted) : 0.0;
+        lastClipped = clipped;
+        lastConverted = converted;
+    }
+
+    // Only while the USB callback isn't running. The state private to tick() is cleared by
+    // tick() itself on its next call, its thread may be inside it right now.
+    void reset() {
+        samplesDelivered = 0;
+        callbacks = 0;
+        swapBlockedNs = 0;
+        usbErrors = 0;
+        droppedSamples = 0;
+        peakQueueDepth = 0;
+        jitter.reset();
+        lastTuneLatencyUs = 0;
+        tunes = 0;
+        tuneLatencySumNs = 0;
+        tuneLatency.reset();
+        lastCallback = 0;
+        tickReset.store(true, std::memory_order_release);
+        samplesPerSecond = 0;
+        startLatencyUs = -1;
+        rateSwitches = 0;
+        rateSwitchGapUs = -1;
+        discontinuities = 0;
+        recoveries = 0;
+        lastOutageUs = -1;
+        outageSamples = 0;
+        latency.reset();
+        levelDbfs = -100.0f;
+        peakDbfs = -100.0f;
+        clippedValues = 0;
+        convertedValues = 0;
+        clipRatio = 0;
+    }
+
+    nlohmann::json toJson() {
+        nlohmann::json j;
+        j["samplesPerSecond"] = samplesPerSecond.load();
+        j["samplesDelivered"] = samplesDelivered.load();
+        j["callbacks"] = callbacks.load();
+        j["swapBlockedNs"] = swapBlockedNs.load();
+        j["usbErrors"] = usbErrors.load();
+        j["droppedSamples"] = droppedSamples.load();
+        j["peakQueueDepth"] = peakQueueDepth.load();
+        j["jitterP50Us"] = jitter.percentile(0.5);
+        j["jitterP99Us"] = jitter.percentile(0.99);
+        j["jitterHistogramUs"] = jitter.toJson();
+        j["lastTuneLatencyUs"] = lastTuneLatencyUs.load();
+        j["startLatencyUs"] = startLatencyUs.load();
+        j["rateSwitches"] = rateSwitches.load();
+        j["rateSwitchGapUs"] = rateSwitchGapUs.load();
+        j["discontinuities"] = discontinuities.load();
+        j["recoveries"] = recoveries.load();
+        j["lastOutageUs"] = lastOutageUs.load();
+        j["outageSamples"] = outageSamples.load();
+        j["latencyP50Us"] = latency.percentile(0.5);
+        j["latencyP99Us"] = latency.percentile(0.99);
+        j["latencyHistogramUs"] = latency.toJson();
+        j["tuneLatencyHistogramUs"] = tuneLatency.toJson();
+        j["levelDbfs"] = levelDbfs.load();
+        j["peakDbfs"] = peakDbfs.load();
+        j["clippedValues"] = clippedValues.load();
+        j["clipRatio"] = clipRatio.load();
+        return j;
+    }
+
+    std::atomic<uint64_t> samplesDelivered{ 0 };
+    std::atomic<uint64_t> callbacks{ 0 };
+    std::atomic<uint64_t> swapBlockedNs{ 0 };
+    std::atomic<uint64_t> usbErrors{ 0 };
+    std::atomic<uint64_t> droppedSamples{ 0 };
+    std::atomic<int> peakQueueDepth{ 0 };
+    std::atomic<double> samplesPerSecond{ 0 };
+    std::atomic<int64_t> lastTuneLatencyUs{ 0 };
+    // From the start request to the first device block, -1 until it arrives
+    std::atomic<int64_t> startLatencyUs{ -1 };
+    // Stream gap of the last live sample rate change, -1 until one happened
+    std::atomic<uint64_t> rateSwitches{ 0 };
+    std::atomic<int64_t> rateSwitchGapUs{ -1 };
+    std::atomic<uint64_t> tunes{ 0 };
+    std::atomic<uint64_t> tuneLatencySumNs{ 0 };
+    std::atomic<float> levelDbfs{ -100.0f };
+    std::atomic<float> peakDbfs{ -100.0f };
+    // I and Q values counted separately
+    std::atomic<uint64_t> clippedValues{ 0 };
+    std::atomic<uint64_t> convertedValues{ 0 };
+    // Fraction of clipped values over the last tick
+    std::atomic<double> clipRatio{ 0 };
+    std::atomic<uint64_t> discontinuities{ 0 };
+    // Stalled streams brought back by reopening the device. An outage runs from the last block
+    // before the stall to the first block after the recovery.
+    std::atomic<uint64_t> recoveries{ 0 };
+    std::atomic<int64_t> lastOutageUs{ -1 };
+    std::atomic<uint64_t> outageSamples{ 0 };
+    Histogram jitter;
+    Histogram tuneLatency;
+    // From USB completion (callback entry) to the return of stream.swap()
+    Histogram latency;
+
+private:
+    int64_t lastCallback = 0;
+    std::atomic<bool> tickReset{ false };
+    int64_t lastTick = 0;
+    uint64_t lastDelivered = 0;
+    uint64_t lastClipped = 0;
+    uint64_t lastConverted = 0;
+};
@@ -0,0 +1,87 @@
+#pragma once
+#include <utils/flog.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <json.hpp>
+
+enum SchedPolicy {
+    SCHED_POLICY_DEFAULT,
+    SCHED_POLICY_FIFO,
+    SCHED_POLICY_RR
+};
+
+inline const char* schedPolicies[] = {
+    "default",
+    "fifo",
+    "rr",
+};
+
+// Scheduling of one of the streaming threads
+struct ThreadPolicy {
+    int policy = SCHED_POLICY_DEFAULT;
+    int priority = 1;
+    std::vector<int> cpus; // Empty for any CPU
+
+    // { "policy": "fifo", "priority": 10, "cpus": [2, 3] }, missing keys keep the defaults
+    static ThreadPolicy fromJson(const nlohmann::json& j) {
+        ThreadPolicy p;
+        if (!j.is_object()) { return p; }
+        if (j.contains("policy")) {
+            std::string name = j["policy"];
+            for (int i = 0; i < 3; i++) {
+                if (name == schedPolicies[i]) { p.policy = i; }
+            }
+        }
+        if (j.contains("priority")) { p.priority = j["priority"]; }
+        if (j.contains("cpus")) {
+            for (auto& c : j["cpus"]) { p.cpus.push_back(c); }
+        }
+        return p;
+    }
+
+    nlohmann::json toJson() const {
+        nlohmann::json j;
+        j["policy"] = schedPolicies[policy];
+        j["priority"] = priority;
+        j["cpus"] = cpus;
+        return j;
+    }
+};
+
+// Applies the policy to the calling thread. Without CAP_SYS_NICE or an RLIMIT_RTPRIO the
+// thread keeps the default scheduler, a bad CPU list leaves it free to run anywhere.
+inline bool applyThreadPolicy(const ThreadPolicy& p, const std::string& what) {
+    bool ok = true;
+    if (!p.cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int c : p.cpus) {
+            if (c >= 0 && c < CPU_SETSIZE) { CPU_SET(c, &set); }
+        }
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err) {
+            flog::warn("Could not pin the {0} thread to its CPUs ({1}), running unpinned", what, strerror(err));
+            ok = false;
+        }
+    }
+
+    if (p.policy != SCHED_POLICY_DEFAULT) {
+        int policy = (p.policy == SCHED_POLICY_FIFO) ? SCHED_FIFO : SCHED_RR;
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = std::clamp<int>(p.priority, sched_get_priority_min(policy), sched_get_priority_max(policy));
+        int err = pthread_setschedparam(pthread_self(), policy, &param);
+        if (err) {
+            flog::warn("Could not give the {0} thread {1} priority {2} ({3}), using the default scheduler", what, schedPolicies[p.policy], param.sched_priority, strerror(err));
+            ok = false;
+        }
+        else {
+            flog::info("Running the {0} thread with {1} priority {2}", what, schedPolicies[p.policy], param.sched_priority);
+        }
+    }
+    return ok;
+}